@@ -8,6 +8,7 @@ const Params = struct {
     target: Build.ResolvedTarget,
     optimize: std.builtin.OptimizeMode,
     includePath: Build.LazyPath,
+    stats: bool = false,
     flags: []const []const u8 = &.{
         "-std=c89",
         "-Wall",
@@ -30,6 +31,9 @@ fn createCObj(
     });
 
     root.addIncludePath(ps.includePath);
+    if (ps.stats) {
+        root.addCMacro("BITS_STATS", "1");
+    }
 
     for (ps.files) |file| {
         root.addCSourceFile(.{ .file = file, .flags = ps.flags });
@@ -55,6 +59,9 @@ fn createCExecutable(
     });
 
     root.addIncludePath(ps.includePath);
+    if (ps.stats) {
+        root.addCMacro("BITS_STATS", "1");
+    }
 
     for (ps.files) |file| {
         root.addCSourceFile(.{ .file = file, .flags = ps.flags });
@@ -76,6 +83,7 @@ pub fn build(b: *Build) void {
     const target = b.standardTargetOptions(.{});
     const optimize = b.standardOptimizeOption(.{});
     const includePath = b.path("include");
+    const stats = b.option(bool, "stats", "Enable libbits usage counters") orelse false;
 
     const bitsLibObj = createCObj(b, .{
         .name = "bits",
@@ -84,10 +92,14 @@ pub fn build(b: *Build) void {
             b.path("src/libbits/channel.c"),
             b.path("src/libbits/fnv.c"),
             b.path("src/libbits/hashtable.c"),
+            b.path("src/libbits/pool.c"),
+            b.path("src/libbits/pipeline.c"),
+            b.path("src/libbits/broadcast.c"),
         },
         .target = target,
         .optimize = optimize,
         .includePath = includePath,
+        .stats = stats,
     });
 
     const arenaTestExe = createCExecutable(b, .{
@@ -96,6 +108,7 @@ pub fn build(b: *Build) void {
         .target = target,
         .optimize = optimize,
         .includePath = includePath,
+        .stats = stats,
     }, &.{bitsLibObj});
 
     const base64Exe = blk: {
@@ -105,6 +118,7 @@ pub fn build(b: *Build) void {
             .target = target,
             .optimize = optimize,
             .includePath = includePath,
+            .stats = stats,
         }, &.{bitsLibObj});
         exe.linkSystemLibrary("ssl");
         exe.linkSystemLibrary("crypto");
@@ -117,6 +131,7 @@ pub fn build(b: *Build) void {
         .target = target,
         .optimize = optimize,
         .includePath = includePath,
+        .stats = stats,
     }, &.{});
 
     const fnvTestExe = createCExecutable(b, .{
@@ -125,6 +140,25 @@ pub fn build(b: *Build) void {
         .target = target,
         .optimize = optimize,
         .includePath = includePath,
+        .stats = stats,
+    }, &.{bitsLibObj});
+
+    const fnvsumExe = createCExecutable(b, .{
+        .name = "fnvsum",
+        .files = &.{b.path("src/cmd/fnvsum.c")},
+        .target = target,
+        .optimize = optimize,
+        .includePath = includePath,
+        .stats = stats,
+    }, &.{bitsLibObj});
+
+    const fnvmanyBenchExe = createCExecutable(b, .{
+        .name = "fnvmany_bench",
+        .files = &.{b.path("src/cmd/fnvmany_bench.c")},
+        .target = target,
+        .optimize = optimize,
+        .includePath = includePath,
+        .stats = stats,
     }, &.{bitsLibObj});
 
     const hashtableTestExe = createCExecutable(b, .{
@@ -133,6 +167,7 @@ pub fn build(b: *Build) void {
         .target = target,
         .optimize = optimize,
         .includePath = includePath,
+        .stats = stats,
     }, &.{bitsLibObj});
 
     const hashtableCompactTestExe = createCExecutable(b, .{
@@ -141,6 +176,34 @@ pub fn build(b: *Build) void {
         .target = target,
         .optimize = optimize,
         .includePath = includePath,
+        .stats = stats,
+    }, &.{bitsLibObj});
+
+    const hashtableStatsTestExe = createCExecutable(b, .{
+        .name = "hashtable_stats_test",
+        .files = &.{b.path("src/cmd/hashtable_stats_test.c")},
+        .target = target,
+        .optimize = optimize,
+        .includePath = includePath,
+        .stats = stats,
+    }, &.{bitsLibObj});
+
+    const hashtableBuildTestExe = createCExecutable(b, .{
+        .name = "hashtable_build_test",
+        .files = &.{b.path("src/cmd/hashtable_build_test.c")},
+        .target = target,
+        .optimize = optimize,
+        .includePath = includePath,
+        .stats = stats,
+    }, &.{bitsLibObj});
+
+    const hashtableFreezeTestExe = createCExecutable(b, .{
+        .name = "hashtable_freeze_test",
+        .files = &.{b.path("src/cmd/hashtable_freeze_test.c")},
+        .target = target,
+        .optimize = optimize,
+        .includePath = includePath,
+        .stats = stats,
     }, &.{bitsLibObj});
 
     const hashtableZigTests = blk: {
@@ -150,6 +213,9 @@ pub fn build(b: *Build) void {
             .optimize = optimize,
         });
         root.addIncludePath(includePath);
+        if (stats) {
+            root.addCMacro("BITS_STATS", "1");
+        }
         root.addObject(bitsLibObj);
         const exe = b.addTest(.{ .root_module = root });
         break :blk exe;
@@ -161,6 +227,7 @@ pub fn build(b: *Build) void {
         .target = target,
         .optimize = optimize,
         .includePath = includePath,
+        .stats = stats,
     }, &.{bitsLibObj});
 
     const messageQueueBasicTestExe = createCExecutable(b, .{
@@ -169,6 +236,7 @@ pub fn build(b: *Build) void {
         .target = target,
         .optimize = optimize,
         .includePath = includePath,
+        .stats = stats,
     }, &.{bitsLibObj});
 
     const messageQueueBlockTestExe = createCExecutable(b, .{
@@ -180,6 +248,106 @@ pub fn build(b: *Build) void {
         .target = target,
         .optimize = optimize,
         .includePath = includePath,
+        .stats = stats,
+    }, &.{bitsLibObj});
+
+    const channelManyTestExe = createCExecutable(b, .{
+        .name = "channel_many_test",
+        .files = &.{b.path("src/cmd/channel_many.c")},
+        .target = target,
+        .optimize = optimize,
+        .includePath = includePath,
+        .stats = stats,
+    }, &.{bitsLibObj});
+
+    const channelCloseTestExe = createCExecutable(b, .{
+        .name = "channel_close_test",
+        .files = &.{b.path("src/cmd/channel_close.c")},
+        .target = target,
+        .optimize = optimize,
+        .includePath = includePath,
+        .stats = stats,
+    }, &.{bitsLibObj});
+
+    const channelSelectTestExe = createCExecutable(b, .{
+        .name = "channel_select_test",
+        .files = &.{b.path("src/cmd/channel_select.c")},
+        .target = target,
+        .optimize = optimize,
+        .includePath = includePath,
+        .stats = stats,
+    }, &.{bitsLibObj});
+
+    const channelFdTestExe = createCExecutable(b, .{
+        .name = "channel_fd_test",
+        .files = &.{b.path("src/cmd/channel_fd.c")},
+        .target = target,
+        .optimize = optimize,
+        .includePath = includePath,
+        .stats = stats,
+    }, &.{bitsLibObj});
+
+    const channelStatsTestExe = createCExecutable(b, .{
+        .name = "channel_stats_test",
+        .files = &.{b.path("src/cmd/channel_stats.c")},
+        .target = target,
+        .optimize = optimize,
+        .includePath = includePath,
+        .stats = stats,
+    }, &.{bitsLibObj});
+
+    const channelShmTestExe = createCExecutable(b, .{
+        .name = "channel_shm_test",
+        .files = &.{b.path("src/cmd/channel_shm.c")},
+        .target = target,
+        .optimize = optimize,
+        .includePath = includePath,
+        .stats = stats,
+    }, &.{bitsLibObj});
+
+    const channelBytesTestExe = createCExecutable(b, .{
+        .name = "channel_bytes_test",
+        .files = &.{b.path("src/cmd/channel_bytes.c")},
+        .target = target,
+        .optimize = optimize,
+        .includePath = includePath,
+        .stats = stats,
+    }, &.{bitsLibObj});
+
+    const poolTestExe = createCExecutable(b, .{
+        .name = "pool_test",
+        .files = &.{b.path("src/cmd/pool_test.c")},
+        .target = target,
+        .optimize = optimize,
+        .includePath = includePath,
+        .stats = stats,
+    }, &.{bitsLibObj});
+
+    const pipelineTestExe = createCExecutable(b, .{
+        .name = "pipeline_test",
+        .files = &.{b.path("src/cmd/pipeline_test.c")},
+        .target = target,
+        .optimize = optimize,
+        .includePath = includePath,
+        .stats = stats,
+    }, &.{bitsLibObj});
+
+    const broadcastTestExe = createCExecutable(b, .{
+        .name = "broadcast_test",
+        .files = &.{b.path("src/cmd/broadcast_test.c")},
+        .target = target,
+        .optimize = optimize,
+        .includePath = includePath,
+        .stats = stats,
+    }, &.{bitsLibObj});
+
+    const channelBenchExe = createCExecutable(b, .{
+        .name = "channel_bench",
+        .files = &.{b.path("src/cmd/channel_bench.c")},
+        .target = target,
+        .optimize = optimize,
+        .includePath = includePath,
+        .stats = stats,
     }, &.{bitsLibObj});
 
     const executables = [_]struct { exe: *Build.Step.Compile, run: bool }{
@@ -187,12 +355,28 @@ pub fn build(b: *Build) void {
         .{ .exe = base64Exe, .run = true },
         .{ .exe = demoOopExe, .run = false },
         .{ .exe = fnvTestExe, .run = true },
+        .{ .exe = fnvsumExe, .run = false },
+        .{ .exe = fnvmanyBenchExe, .run = false },
         .{ .exe = hashtableTestExe, .run = true },
         .{ .exe = hashtableCompactTestExe, .run = true },
+        .{ .exe = hashtableStatsTestExe, .run = true },
+        .{ .exe = hashtableBuildTestExe, .run = true },
+        .{ .exe = hashtableFreezeTestExe, .run = true },
         .{ .exe = hashtableZigTests, .run = true },
         .{ .exe = lambdaExe, .run = true },
         .{ .exe = messageQueueBasicTestExe, .run = true },
         .{ .exe = messageQueueBlockTestExe, .run = true },
+        .{ .exe = channelManyTestExe, .run = true },
+        .{ .exe = channelCloseTestExe, .run = true },
+        .{ .exe = channelSelectTestExe, .run = true },
+        .{ .exe = channelFdTestExe, .run = true },
+        .{ .exe = channelStatsTestExe, .run = true },
+        .{ .exe = channelShmTestExe, .run = true },
+        .{ .exe = channelBytesTestExe, .run = true },
+        .{ .exe = poolTestExe, .run = true },
+        .{ .exe = pipelineTestExe, .run = true },
+        .{ .exe = broadcastTestExe, .run = true },
+        .{ .exe = channelBenchExe, .run = false },
     };
 
     const testStep = b.step("test", "Run tests");
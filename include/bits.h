@@ -2,9 +2,11 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <time.h>
 
 typedef struct Message Message;
 typedef struct Channel Channel;
+typedef struct Select Select;
 
 struct Message
 {
@@ -17,22 +19,275 @@ struct Message
     intptr_t value;
 };
 
-Channel *channelcreate(uint8_t capacity);
+/* Channel kinds: Clocked is safe for any number of threads on either side;
+ * Cspsc is a lock-free ring for exactly one producer and one consumer thread;
+ * Cmpmc is a lock-free queue for any number of threads on either side.
+ * Cbytes is a lock-free ring of variable-length records for one producer and
+ * one consumer thread; its capacity counts bytes and it carries no Messages,
+ * only the record calls below. */
+enum
+{
+    Clocked = 0,
+    Cspsc = 1,
+    Cmpmc = 2,
+    Cbytes = 3
+};
+
+/* capacity may be up to INT_MAX; powers of two index with a mask instead of a division */
+Channel *channelcreate(size_t capacity);
+Channel *channelcreatekind(size_t capacity, int kind);
+
+/* A channel in a memfd that several processes can use at once.  channelshm
+ * creates it and stores the memfd in *fd (close-on-exec; pass it on by fork
+ * or SCM_RIGHTS and close it when no longer needed); channelmap maps the
+ * channel behind such an fd.  Both sides then use the usual calls, except
+ * channelfd and channelselect.  channeldestroy only unmaps the calling
+ * process's view, so no thread of it may be inside a call on the channel;
+ * end the channel with channelclose. */
+Channel *channelshm(size_t capacity, int kind, int *fd);
+Channel *channelmap(int fd);
+
+/* channelclose wakes every blocked caller: puts fail from then on, gets drain
+ * what is left and then fail.  channeldestroy closes, waits for blocked
+ * callers to return and frees the channel, dropping undelivered messages. */
+void channelclose(Channel *c);
 void channeldestroy(Channel *c);
+
+/* Single-message calls return 0 on success, 1 when channelput or
+ * channeltryget would have to wait, 2 once the channel is closed (and, for
+ * gets, drained) and -1 on error; channelputwait and channelget spin
+ * briefly, then sleep */
 int channelput(Channel *c, Message *in);
+int channelputwait(Channel *c, Message *in);
 int channelget(Channel *c, Message *out);
+int channeltryget(Channel *c, Message *out);
+
+/* channelget that gives up at the absolute CLOCK_MONOTONIC deadline and
+ * returns 1; a NULL deadline waits forever */
+int channelgettimed(Channel *c, Message *out, struct timespec const *deadline);
+
+/* Move up to n messages with one synchronization, waiting only until at least
+ * one can move; returns the number moved, 0 once closed (and drained) or -1 */
+int channelputmany(Channel *c, int n, Message *in);
+int channelgetmany(Channel *c, int n, Message *out);
 int channelsize(Channel *c);
 
+/* An eventfd that is readable while the channel holds messages or is closed,
+ * for epoll and poll loops; created on the first call and closed with the
+ * channel, -1 for process-shared channels.  Never read it: a get that finds
+ * the channel empty clears it, so drain with channeltryget until it returns
+ * 1 (or 2) on each wakeup. */
+int channelfd(Channel *c);
+
+/* Records on a Cbytes channel are written and read in place.  The producer
+ * reserves room for up to size bytes, fills *slot and commits the size it
+ * wrote, at most the size reserved; the consumer acquires the oldest record,
+ * reads its size bytes at *slot and releases it, and the room is free again.
+ * Slots are aligned to 16 bytes, a record with its 16-byte header may take
+ * half the capacity, and a slot stays valid until its commit or release.
+ * Return values are as for channelput and channelget (channelreserve and
+ * channeltryacquire do not wait); a size that can never fit is an error,
+ * and so are a commit or release with nothing reserved or acquired. */
+int channelreserve(Channel *c, size_t size, void **slot);
+int channelreservewait(Channel *c, size_t size, void **slot);
+int channelcommit(Channel *c, size_t size);
+int channelacquire(Channel *c, void **slot, size_t *size);
+int channeltryacquire(Channel *c, void **slot, size_t *size);
+int channelrelease(Channel *c);
+
+typedef struct Channelstats Channelstats;
+
+/* Counters are kept only with BITS_STATS and read as zero otherwise */
+struct Channelstats
+{
+    size_t capacity;    /**< capacity the channel was created with; Cbytes: rounded up to 16 */
+    size_t size;        /**< messages queued when read; Cbytes: bytes, headers included */
+    uint64_t puts;      /**< messages put */
+    uint64_t gets;      /**< messages taken */
+    uint64_t full;      /**< put calls that found no room on the first try */
+    uint64_t empty;     /**< get calls that found no message on the first try */
+    uint64_t putwaitns; /**< nanoseconds put calls spent waiting for room */
+    uint64_t getwaitns; /**< nanoseconds get calls spent waiting for messages */
+    uint64_t contended; /**< Clocked: lock acquisitions that had to wait */
+    uint64_t depth[16]; /**< put calls by depth after them: bucket i holds 2^i to 2^(i+1) - 1, the last bucket the rest */
+};
+
+int channelstats(Channel *c, Channelstats *s);
+
+/* Select case operations */
+enum
+{
+    Sget = 0,
+    Sput = 1
+};
+
+/* One case of channelselect: a get into or a put from *m on c; rc is the
+ * outcome once the case fires, as for a single-message call (0 moved,
+ * 2 closed, -1 error) */
+struct Select
+{
+    Channel *c;
+    int op;
+    Message *m;
+    int rc;
+};
+
+/* Wait until one of the n cases can fire, fire it and return its index; -1
+ * with errno ETIMEDOUT once the absolute CLOCK_MONOTONIC deadline passes
+ * (NULL waits forever) or EINVAL for a bad case or a process-shared channel.
+ * Ready cases are tried from a rotating start so that none starves, and the
+ * caller sleeps on one word that any watched channel signals. */
+int channelselect(Select *s, int n, struct timespec const *deadline);
+
+typedef struct Pool Pool;
+
+/* Work-stealing task pool: each worker runs tasks from its own deque, newest
+ * first, and when that is empty takes external submissions or steals the
+ * oldest task of another worker.  nworkers 0 means one per online CPU. */
+Pool *poolcreate(int nworkers);
+
+/* Run fn(arg) on some worker.  A task submitted from a worker goes on that
+ * worker's deque; any other thread queues it for whichever worker is free.
+ * Returns 0 or -1 when out of memory. */
+int poolsubmit(Pool *p, void fn(void *), void *arg);
+
+/* Hand every message later read from c to the pool as fn((void *)m.value),
+ * until c is closed or delivers a Tclose; one feed per pool, -1 otherwise. */
+int poolfeed(Pool *p, Channel *c, void fn(void *));
+
+/* Sleep until every submitted task, including those submitted by tasks, has
+ * run; -1 when called from a task.  Feed messages count once taken. */
+int poolwait(Pool *p);
+
+/* Close the feed, run what it still holds, wait for all tasks and free. */
+void pooldestroy(Pool *p);
+
+typedef struct Pipeline Pipeline;
+typedef struct Stagestats Stagestats;
+
+/* Stages run in order, each on its own worker threads and joined by
+ * channels of the given capacity, so a slow stage fills the channel before
+ * it and stalls everything upstream of it. */
+Pipeline *pipelinecreate(size_t capacity);
+
+/* Append a stage of nworkers threads, each calling fn(arg, m) on the
+ * messages it takes; fn changes *m in place and returns nonzero to drop it.
+ * An ordered stage emits messages in the order they entered the pipeline,
+ * however its workers finish them.  The name is kept, not copied.  Returns
+ * the stage index, or -1 once started. */
+int pipelinestage(Pipeline *p, char const *name, int fn(void *, Message *), void *arg, int nworkers, int ordered);
+
+/* Start the workers; after a failure only pipelinedestroy is allowed. */
+int pipelinestart(Pipeline *p);
+
+/* Feed the first stage and read what the last emits, waiting while the
+ * pipeline is full or empty; return values as for channelputwait and
+ * channelget, so pipelineget returns 2 once closed and drained. */
+int pipelineput(Pipeline *p, Message *in);
+int pipelineget(Pipeline *p, Message *out);
+
+/* No more input: each stage finishes what it holds and closes the next. */
+void pipelineclose(Pipeline *p);
+
+/* Time is summed over a stage's workers since pipelinestart: busyns in fn,
+ * idlens waiting for input, blockedns waiting for room downstream (or for
+ * earlier messages, when ordered).  busyns / elapsedns is the stage's
+ * utilization; the bottleneck is the stage near 1 with idle stages after it
+ * and blocked stages before it. */
+struct Stagestats
+{
+    char const *name;
+    int nworkers;
+    uint64_t items;
+    uint64_t busyns;
+    uint64_t idlens;
+    uint64_t blockedns;
+    uint64_t elapsedns;
+};
+
+int pipelinestats(Pipeline *p, int stage, Stagestats *s);
+
+/* Stop every worker, dropping messages still inside, and free. */
+void pipelinedestroy(Pipeline *p);
+
+typedef struct Broadcast Broadcast;
+
+/* A ring that delivers every message to every reader: any number of threads
+ * put, and each subscribed reader takes every message in turn through its
+ * own cursor.  A put waits while the slowest reader is capacity messages
+ * behind; with no readers, puts never wait and messages go unread. */
+Broadcast *broadcastcreate(size_t capacity, int maxreaders);
+
+/* Returns a reader id for one thread's gets, or -1 when maxreaders are
+ * subscribed or a put has happened: subscribe everyone before the first
+ * put, in a way that happens before it.  A reader that stops reading must
+ * unsubscribe, or it holds the writers up. */
+int broadcastsubscribe(Broadcast *b);
+void broadcastunsubscribe(Broadcast *b, int id);
+
+/* Return values as for channelput, channelputwait, channelget and
+ * channeltryget; gets drain what was put before broadcastclose. */
+int broadcastput(Broadcast *b, Message *in);
+int broadcastputwait(Broadcast *b, Message *in);
+int broadcastget(Broadcast *b, int id, Message *out);
+int broadcasttryget(Broadcast *b, int id, Message *out);
+void broadcastclose(Broadcast *b);
+
+/* No thread may be inside a call on b. */
+void broadcastdestroy(Broadcast *b);
+
+typedef struct Fnv Fnv;
+
+/* incremental state: fnvfinal after fnvupdate over any split of the input equals fnv */
+struct Fnv
+{
+    uint64_t hash;
+};
+
 uint64_t fnv(size_t datalen, unsigned char const *data);
+void fnvinit(Fnv *s);
+void fnvupdate(Fnv *s, size_t datalen, unsigned char const *data);
+uint64_t fnvfinal(Fnv const *s);
+void fnvmany(size_t n, size_t const *lens, unsigned char const *const *ptrs, uint64_t *out);
 
 typedef struct Table Table;
+typedef struct Tablestats Tablestats;
+typedef struct Frozen Frozen;
+
+struct Tablestats
+{
+    size_t columns;    /**< number of columns */
+    size_t live;       /**< entries holding a key */
+    size_t deleted;    /**< tombstones left by tabledel */
+    size_t nodes;      /**< heap-allocated chain nodes */
+    size_t maxchain;   /**< longest chain, counting the embedded entry */
+    size_t chains[8];  /**< columns by chain length, the last bucket is 7 or more */
+    size_t nodebytes;  /**< bytes used by chain nodes */
+    size_t keybytes;   /**< bytes used by duplicated keys */
+    uint64_t lookups;  /**< tableget calls, only counted with BITS_STATS */
+    uint64_t misses;   /**< tableget calls that found nothing */
+    uint64_t probes;   /**< entries examined by tableget */
+};
+
+enum
+{
+    Bunique = 1 << 0,  /**< tablebuild: keys are known to be distinct */
+    Bparallel = 1 << 1 /**< tablebuild: hash keys on several threads */
+};
 
 Table *tablecreate(size_t columns_len);
+Table *tablebuild(size_t n, char const *const *keys, void *const *values, int flags);
 void tabledestroy(Table *t, void finalize(void *));
 int tableput(Table *t, char const *key, void *value);
 void *tableget(Table *t, char const *key);
+void *tablegethash(Table *t, uint64_t hash, char const *key);
 int tabledel(Table *t, char const *key, void finalize(void *));
 void tablecompact(Table *t);
+int tablestats(Table *t, Tablestats *s);
+Frozen *tablefreeze(Table *t);
+void *frozenget(Frozen *f, char const *key);
+void *frozengethash(Frozen *f, uint64_t hash, char const *key);
+void frozendestroy(Frozen *f);
 
 void *aalloc(int n, int t);
 void areset(int t);
@@ -5,6 +5,17 @@ extern "C"
 #include "bits.h"
 }
 
+#if __cplusplus >= 202002L
+#    include <atomic>
+#    include <condition_variable>
+#    include <coroutine>
+#    include <cstdlib>
+#    include <deque>
+#    include <exception>
+#    include <mutex>
+#    include <optional>
+#endif
+
 template <typename F>
 struct Deferred
 {
@@ -25,3 +36,403 @@ inline Deferred<F> mkdeferred(F f)
 #define DO_JOINSTRING2(x, y) x##y
 #define JOINSTRING2(x, y)    DO_JOINSTRING2(x, y)
 #define defer(stmt)          auto JOINSTRING2(defer_, __LINE__) = mkdeferred([&]() { stmt })
+
+namespace bits
+{
+
+constexpr uint64_t fnvoffsetbasis = 0xcbf29ce484222325;
+constexpr uint64_t fnvprime = 0x100000001b3;
+
+// Same as fnv() in src/libbits/fnv.c, usable in constant expressions.
+constexpr uint64_t fnv(size_t datalen, char const *data)
+{
+    uint64_t hash = fnvoffsetbasis;
+
+    for (size_t i = 0; i < datalen; ++i)
+    {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= fnvprime;
+    }
+
+    return hash;
+}
+
+// Hash a key as Table and Frozen do, including its terminating NUL.
+constexpr uint64_t fnvkey(char const *key)
+{
+    size_t len = 0;
+
+    while (key[len] != '\0')
+        ++len;
+
+    return fnv(len + 1, key);
+}
+
+// A key with its hash, so lookups on constant keys do no hashing at run time.
+struct Key
+{
+    uint64_t hash;
+    char const *str;
+
+    constexpr Key(uint64_t hash, char const *str)
+        : hash(hash)
+        , str(str)
+    {
+    }
+};
+
+inline void *tableget(Table *t, Key const &key)
+{
+    return ::tablegethash(t, key.hash, key.str);
+}
+
+inline void *frozenget(Frozen *f, Key const &key)
+{
+    return ::frozengethash(f, key.hash, key.str);
+}
+
+namespace literals
+{
+
+// "key"_fnv is fnvkey("key"), a constant that can label a case.
+constexpr uint64_t operator""_fnv(char const *s, size_t len)
+{
+    return fnv(len + 1, s);
+}
+
+constexpr Key operator""_key(char const *s, size_t len)
+{
+    return Key(fnv(len + 1, s), s);
+}
+
+} // namespace literals
+
+#if __cplusplus >= 202002L
+
+class Executor;
+
+// A coroutine run by an Executor: spawn it and it runs to completion on the
+// executor's threads, resuming there after every co_await on an AsyncChannel.
+class Task
+{
+public:
+    struct promise_type
+    {
+        Executor *executor = nullptr;
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+
+        // Frees the frame and tells the executor the task is done.
+        struct Final
+        {
+            bool await_ready() noexcept { return false; }
+            void await_suspend(std::coroutine_handle<promise_type> h) noexcept;
+            void await_resume() noexcept {}
+        };
+
+        Final final_suspend() noexcept { return {}; }
+    };
+
+    explicit Task(std::coroutine_handle<promise_type> h)
+        : h(h)
+    {
+    }
+    Task(Task &&t) noexcept
+        : h(t.h)
+    {
+        t.h = nullptr;
+    }
+    Task(Task const &) = delete;
+    Task &operator=(Task const &) = delete;
+    ~Task()
+    {
+        if (h)
+            h.destroy();
+    }
+
+private:
+    friend class Executor;
+    std::coroutine_handle<promise_type> h;
+};
+
+// Resumes suspended tasks.  wait() returns once every spawned task has finished.
+class Executor
+{
+public:
+    virtual ~Executor() = default;
+    virtual void schedule(std::coroutine_handle<> h) = 0;
+
+    void spawn(Task &&t)
+    {
+        std::coroutine_handle<Task::promise_type> h = t.h;
+
+        t.h = nullptr;
+        h.promise().executor = this;
+        {
+            std::lock_guard<std::mutex> g(lock);
+            ++live;
+        }
+        schedule(h);
+    }
+
+    void finished()
+    {
+        std::lock_guard<std::mutex> g(lock);
+        if (--live == 0)
+            idle.notify_all();
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> g(lock);
+        idle.wait(g, [this] { return live == 0; });
+    }
+
+protected:
+    std::mutex lock;
+    std::condition_variable idle; // also signals Loop's ready queue
+    long live = 0;
+};
+
+inline void Task::promise_type::Final::await_suspend(std::coroutine_handle<promise_type> h) noexcept
+{
+    Executor *e = h.promise().executor;
+
+    h.destroy();
+    e->finished();
+}
+
+// Single-threaded executor: run() resumes tasks on the calling thread until
+// all have finished.  Other threads may schedule onto it.
+class Loop : public Executor
+{
+public:
+    void schedule(std::coroutine_handle<> h) override
+    {
+        std::lock_guard<std::mutex> g(lock);
+        ready.push_back(h);
+        idle.notify_all();
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> g(lock);
+
+        for (;;)
+        {
+            idle.wait(g, [this] { return !ready.empty() || live == 0; });
+            if (ready.empty())
+                return;
+
+            std::coroutine_handle<> h = ready.front();
+            ready.pop_front();
+            g.unlock();
+            h.resume();
+            g.lock();
+        }
+    }
+
+private:
+    std::deque<std::coroutine_handle<>> ready;
+};
+
+// Multi-threaded executor on a libbits work-stealing Pool; nthreads 0 means
+// one per online CPU.  A task woken from a worker resumes on that worker.
+class PoolExecutor : public Executor
+{
+public:
+    explicit PoolExecutor(int nthreads = 0)
+        : pool(::poolcreate(nthreads))
+    {
+        if (pool == nullptr)
+            std::abort();
+    }
+    PoolExecutor(PoolExecutor const &) = delete;
+    PoolExecutor &operator=(PoolExecutor const &) = delete;
+    ~PoolExecutor() override
+    {
+        wait();
+        ::pooldestroy(pool);
+    }
+
+    void schedule(std::coroutine_handle<> h) override
+    {
+        if (::poolsubmit(pool, resume, h.address()) != 0)
+            std::abort();
+    }
+
+private:
+    static void resume(void *address) { std::coroutine_handle<>::from_address(address).resume(); }
+
+    Pool *pool;
+};
+
+// A Channel whose get and put suspend the calling Task instead of its
+// thread.  A task that finds the channel empty (or full) queues itself; the
+// put (or get) that makes room completes its operation for it and schedules
+// it, so it resumes with the result in hand.  Every producer and consumer
+// must go through the AsyncChannel, or wakeups are missed.
+class AsyncChannel
+{
+    struct Waiter
+    {
+        std::coroutine_handle<Task::promise_type> h;
+        Message *m;
+        int *rc;
+    };
+
+public:
+    // co_await get() yields the next message, or nothing once closed and drained.
+    class Get
+    {
+    public:
+        bool await_ready()
+        {
+            rc = ::channeltryget(ch->c, &m);
+            if (rc == 0)
+                ch->settle();
+            return rc != 1;
+        }
+        bool await_suspend(std::coroutine_handle<Task::promise_type> h) { return ch->park(ch->getters, Waiter{ h, &m, &rc }); }
+        std::optional<Message> await_resume()
+        {
+            if (rc != 0)
+                return std::nullopt;
+            return m;
+        }
+
+    private:
+        friend class AsyncChannel;
+        explicit Get(AsyncChannel *ch)
+            : ch(ch)
+        {
+        }
+
+        AsyncChannel *ch;
+        Message m{};
+        int rc = 1;
+    };
+
+    // co_await put(m) yields true once m is queued, false if the channel is closed.
+    class Put
+    {
+    public:
+        bool await_ready()
+        {
+            rc = ::channelput(ch->c, &m);
+            if (rc == 0)
+                ch->settle();
+            return rc != 1;
+        }
+        bool await_suspend(std::coroutine_handle<Task::promise_type> h) { return ch->park(ch->putters, Waiter{ h, &m, &rc }); }
+        bool await_resume() { return rc == 0; }
+
+    private:
+        friend class AsyncChannel;
+        Put(AsyncChannel *ch, Message m)
+            : ch(ch)
+            , m(m)
+        {
+        }
+
+        AsyncChannel *ch;
+        Message m;
+        int rc = 1;
+    };
+
+    // Operations run on whichever thread resumes a task, so only the kinds
+    // that take any number of producers and consumers will do.
+    explicit AsyncChannel(size_t capacity, int kind = Cmpmc)
+        : c((kind == Clocked || kind == Cmpmc) ? ::channelcreatekind(capacity, kind) : nullptr)
+    {
+        if (c == nullptr)
+            std::abort();
+    }
+    AsyncChannel(AsyncChannel const &) = delete;
+    AsyncChannel &operator=(AsyncChannel const &) = delete;
+    ~AsyncChannel() { ::channeldestroy(c); }
+
+    Get get() { return Get(this); }
+    Put put(Message m) { return Put(this, m); }
+
+    // Close the channel; parked getters drain what is left, then everyone sees the close.
+    void close()
+    {
+        ::channelclose(c);
+        std::lock_guard<std::mutex> g(lock);
+        handoff(getters);
+        handoff(putters);
+    }
+
+    Channel *channel() { return c; }
+
+private:
+    // Queue a task that missed, unless a last try under the lock succeeds:
+    // settle runs under the same lock, so it either sees the waiter or ran
+    // before the try and left its change for the try to find.
+    bool park(std::deque<Waiter> &q, Waiter w)
+    {
+        std::lock_guard<std::mutex> g(lock);
+
+        waiting.fetch_add(1, std::memory_order_seq_cst);
+        *w.rc = (&q == &getters) ? ::channeltryget(c, w.m) : ::channelput(c, w.m);
+        if (*w.rc != 1)
+        {
+            waiting.fetch_sub(1, std::memory_order_relaxed);
+            handoff(&q == &getters ? putters : getters);
+            return false;
+        }
+
+        q.push_back(w);
+        return true;
+    }
+
+    // After a successful get or put: finish the operations of parked tasks
+    // that can now complete.  Free while nobody is parked.
+    void settle()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_relaxed) == 0)
+            return;
+
+        std::lock_guard<std::mutex> g(lock);
+        while (handoff(getters) + handoff(putters) > 0)
+            ;
+    }
+
+    // Complete as many parked operations in q as the channel allows and
+    // schedule their tasks; returns how many completed.  Caller holds lock.
+    int handoff(std::deque<Waiter> &q)
+    {
+        int n = 0;
+
+        while (!q.empty())
+        {
+            Waiter w = q.front();
+
+            *w.rc = (&q == &getters) ? ::channeltryget(c, w.m) : ::channelput(c, w.m);
+            if (*w.rc == 1)
+                break;
+
+            q.pop_front();
+            waiting.fetch_sub(1, std::memory_order_relaxed);
+            w.h.promise().executor->schedule(w.h);
+            n += 1;
+        }
+
+        return n;
+    }
+
+    Channel *c;
+    std::mutex lock;
+    std::deque<Waiter> getters;
+    std::deque<Waiter> putters;
+    std::atomic<int> waiting{ 0 };
+};
+
+#endif
+
+} // namespace bits
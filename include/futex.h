@@ -0,0 +1,85 @@
+#pragma once
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct Event Event;
+
+/* Eventcount: a waiter takes a key, re-checks its condition and sleeps only
+ * if state still equals the key; a notifier changes the condition first and
+ * advances state only when the low bit says someone registered since the last
+ * advance, so the uncontended path and repeated notifies before the woken
+ * threads run never enter the kernel. */
+struct Event
+{
+    uint32_t state; /**< Epoch in the upper bits, waiters-present in bit 0 */
+    int32_t spin;   /**< Running estimate of polls that pay off before parking */
+    int32_t flags;  /**< FUTEX_PRIVATE_FLAG, or 0 when shared between processes */
+};
+
+static __inline__ void cpurelax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/* Sleep while *addr == expect, until woken or the absolute CLOCK_MONOTONIC
+ * deadline passes.  flags is FUTEX_PRIVATE_FLAG for a word only this process
+ * maps, 0 for one in memory shared with other processes. */
+static __inline__ int futexwait(uint32_t *addr, uint32_t expect, struct timespec const *deadline, int flags)
+{
+    long rc;
+
+    rc = syscall(SYS_futex, addr, FUTEX_WAIT_BITSET | flags, expect, deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+    if (rc == -1 && errno != EAGAIN && errno != EINTR)
+        return -1;
+
+    return 0;
+}
+
+static __inline__ void futexwake(uint32_t *addr, int n, int flags)
+{
+    (void)syscall(SYS_futex, addr, FUTEX_WAKE | flags, n, NULL, NULL, 0);
+}
+
+/* shared: the event lives in memory mapped by several processes */
+static __inline__ void eventinit(Event *e, int32_t spin, int shared)
+{
+    e->state = 0;
+    e->spin = spin;
+    e->flags = shared ? 0 : FUTEX_PRIVATE_FLAG;
+}
+
+/* Register as a waiter; the caller must re-check its condition before eventwait. */
+static __inline__ uint32_t eventprepare(Event *e)
+{
+    return __atomic_fetch_or(&e->state, 1U, __ATOMIC_SEQ_CST) | 1U;
+}
+
+static __inline__ int eventwait(Event *e, uint32_t key, struct timespec const *deadline)
+{
+    return futexwait(&e->state, key, deadline, e->flags);
+}
+
+/* Call after making a waiter's condition true; wakes every registered waiter. */
+static __inline__ void eventnotify(Event *e)
+{
+    uint32_t s;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    s = __atomic_load_n(&e->state, __ATOMIC_RELAXED);
+    while ((s & 1U) != 0)
+    {
+        if (__atomic_compare_exchange_n(&e->state, &s, (s + 2U) & ~1U, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        {
+            futexwake(&e->state, INT_MAX, e->flags);
+            return;
+        }
+    }
+}
@@ -0,0 +1,131 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include "bits.hpp"
+
+namespace
+{
+
+constexpr size_t cap = 4;
+
+constexpr int nproducers = 3;
+constexpr int nconsumers = 8;
+constexpr long perproducer = 20000;
+
+struct Totals
+{
+    std::atomic<long> sum{ 0 };
+    std::atomic<long> count{ 0 };
+    std::atomic<int> producing{ nproducers };
+};
+
+// Sends 1..perproducer; the last producer to finish closes the channel.
+bits::Task produce(bits::AsyncChannel &ch, Totals &t)
+{
+    for (long i = 1; i <= perproducer; ++i)
+    {
+        if (!co_await ch.put(Message{ Message::Tsome, static_cast<intptr_t>(i) }))
+            std::abort();
+    }
+
+    if (t.producing.fetch_sub(1) == 1)
+        ch.close();
+}
+
+bits::Task consume(bits::AsyncChannel &ch, Totals &t)
+{
+    while (std::optional<Message> m = co_await ch.get())
+    {
+        t.sum.fetch_add(static_cast<long>(m->value), std::memory_order_relaxed);
+        t.count.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// A put on a closed channel fails, and a get on it returns nothing.
+bits::Task closed(bits::AsyncChannel &ch, bool &ok)
+{
+    bool put = co_await ch.put(Message{ Message::Tsome, 1 });
+    std::optional<Message> m = co_await ch.get();
+
+    ok = !put && !m;
+}
+
+bool check(char const *name, Totals &t)
+{
+    long const expect = nproducers * (perproducer * (perproducer + 1) / 2);
+
+    if (t.count != nproducers * perproducer || t.sum != expect)
+    {
+        std::fprintf(stderr, "%s: %ld messages summing to %ld, expected %ld summing to %ld\n", name, t.count.load(),
+                     t.sum.load(), nproducers * perproducer, expect);
+        return false;
+    }
+
+    return true;
+}
+
+template <class Spawn>
+void start(bits::AsyncChannel &ch, Totals &t, Spawn spawn)
+{
+    // consumers first, so they park on the empty channel
+    for (int i = 0; i < nconsumers; ++i)
+        spawn(consume(ch, t));
+    for (int i = 0; i < nproducers; ++i)
+        spawn(produce(ch, t));
+}
+
+bool loop(int kind)
+{
+    bits::AsyncChannel ch(cap, kind);
+    bits::Loop l;
+    Totals t;
+
+    start(ch, t, [&](bits::Task &&task) { l.spawn(std::move(task)); });
+    l.run();
+
+    return check("loop", t);
+}
+
+bool pool(int nthreads)
+{
+    bits::AsyncChannel ch(cap);
+    bits::PoolExecutor p(nthreads);
+    Totals t;
+
+    start(ch, t, [&](bits::Task &&task) { p.spawn(std::move(task)); });
+    p.wait();
+
+    return check("pool", t);
+}
+
+bool afterclose()
+{
+    bits::AsyncChannel ch(cap);
+    bits::Loop l;
+    bool ok = false;
+
+    ch.close();
+    l.spawn(closed(ch, ok));
+    l.run();
+
+    return ok;
+}
+
+} // namespace
+
+int main()
+{
+    // consumers contend, so only the multi-consumer kinds apply
+    if (!loop(Clocked) || !loop(Cmpmc))
+        return EXIT_FAILURE;
+
+    if (!pool(1) || !pool(4) || !pool(0))
+        return EXIT_FAILURE;
+
+    if (!afterclose())
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,204 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bits.h"
+#include "printf.h"
+
+static size_t const cap = 64U;
+
+enum
+{
+    nwriters = 2,
+    nreaders = 3
+};
+
+static intptr_t const count = 20000;
+
+/* the slow reader naps every slowevery messages; the quitter leaves after quitafter */
+static intptr_t const slowevery = 2000;
+static intptr_t const quitafter = 1000;
+
+typedef struct Reader Reader;
+
+struct Reader
+{
+    Broadcast *b;
+    int id;
+    int slow;
+    intptr_t seen;
+    int ok;
+};
+
+typedef struct Writer Writer;
+
+struct Writer
+{
+    Broadcast *b;
+    intptr_t first;
+};
+
+static void *produce(void *data)
+{
+    Writer *w = data;
+    Message m;
+    intptr_t i;
+
+    m.tag = Tsome;
+    for (i = 0; i < count; ++i)
+    {
+        m.value = w->first + i;
+        if (broadcastputwait(w->b, &m) != 0)
+            break;
+    }
+
+    return NULL;
+}
+
+/* Every message of every writer, each writer's in order. */
+static void *consume(void *data)
+{
+    Reader *r = data;
+    intptr_t last[nwriters];
+    Message m;
+    struct timespec ts;
+    int rc, w;
+
+    for (w = 0; w < nwriters; ++w)
+        last[w] = -1;
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = 1000000;
+
+    while ((rc = broadcastget(r->b, r->id, &m)) == 0)
+    {
+        w = (int)(m.value / count);
+        if (w < 0 || w >= nwriters || m.value % count <= last[w])
+        {
+            eprintf("reader %d: %" PRIdPTR " out of order\n", r->id, m.value);
+            return NULL;
+        }
+
+        last[w] = m.value % count;
+        r->seen += 1;
+        if (r->slow && r->seen % slowevery == 0)
+            (void)nanosleep(&ts, NULL);
+    }
+
+    r->ok = (rc == 2 && r->seen == nwriters * count);
+    return NULL;
+}
+
+/* Leaves early; the writers must not wait for it. */
+static void *quit(void *data)
+{
+    Reader *r = data;
+    Message m;
+
+    while (r->seen < quitafter && broadcastget(r->b, r->id, &m) == 0)
+        r->seen += 1;
+
+    broadcastunsubscribe(r->b, r->id);
+    r->ok = (r->seen == quitafter);
+    return NULL;
+}
+
+/* Subscriptions end at the first put, and without readers puts never wait. */
+static int edges(void)
+{
+    int ret = 0, id;
+    size_t i;
+    Broadcast *b;
+    Message m = { Tsome, 0 };
+
+    if (broadcastcreate(0, 1) != NULL || broadcastcreate(cap, 0) != NULL)
+        return 0;
+
+    b = broadcastcreate(cap, 1);
+    if (b == NULL)
+        return 0;
+
+    id = broadcastsubscribe(b);
+    if (id != 0 || broadcastsubscribe(b) != -1 || broadcasttryget(b, id, &m) != 1)
+        goto destroyb;
+
+    broadcastunsubscribe(b, id);
+    for (i = 0; i < 2 * cap; ++i)
+    {
+        if (broadcastput(b, &m) != 0)
+            goto destroyb;
+    }
+
+    broadcastclose(b);
+    if (broadcastput(b, &m) != 2 || broadcastget(b, 1, &m) != -1)
+        goto destroyb;
+
+    ret = 1;
+destroyb:
+    broadcastdestroy(b);
+    return ret;
+}
+
+int main(void)
+{
+    Broadcast *b;
+    Reader r[nreaders + 1];
+    Writer w[nwriters];
+    pthread_t rt[nreaders + 1], wt[nwriters];
+    int i, ret = EXIT_FAILURE;
+
+    if (!edges())
+        return EXIT_FAILURE;
+
+    b = broadcastcreate(cap, nreaders + 1);
+    if (b == NULL)
+        return EXIT_FAILURE;
+
+    for (i = 0; i <= nreaders; ++i)
+    {
+        r[i].b = b;
+        r[i].id = broadcastsubscribe(b);
+        r[i].slow = (i == 0);
+        r[i].seen = 0;
+        r[i].ok = 0;
+        if (r[i].id != i)
+            return EXIT_FAILURE;
+    }
+
+    for (i = 0; i <= nreaders; ++i)
+    {
+        if (pthread_create(&rt[i], NULL, (i < nreaders) ? consume : quit, &r[i]) != 0)
+            return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < nwriters; ++i)
+    {
+        w[i].b = b;
+        w[i].first = i * count;
+        if (pthread_create(&wt[i], NULL, produce, &w[i]) != 0)
+            return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < nwriters; ++i)
+        (void)pthread_join(wt[i], NULL);
+
+    broadcastclose(b);
+
+    for (i = 0; i <= nreaders; ++i)
+        (void)pthread_join(rt[i], NULL);
+
+    for (i = 0; i <= nreaders; ++i)
+    {
+        if (!r[i].ok)
+        {
+            eprintf("reader %d saw %" PRIdPTR " messages\n", i, r[i].seen);
+            goto destroyb;
+        }
+    }
+
+    ret = EXIT_SUCCESS;
+destroyb:
+    broadcastdestroy(b);
+    return ret;
+}
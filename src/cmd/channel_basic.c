@@ -5,12 +5,15 @@
 #include <stdlib.h>
 
 #include "bits.h"
+#include "macro.h"
 #include "printf.h"
 
 static int const count = 100;
 
 static uint8_t const cap = 4U;
 
+static int const kinds[] = { Clocked, Cspsc, Cmpmc };
+
 static void fail(char const *msg)
 {
     eprintf("%s\n", msg);
@@ -64,7 +67,7 @@ static int consume(Channel *c, Message *out)
     return out->tag != Tclose;
 }
 
-int main(void)
+static int run(int kind)
 {
     int rc;
     int ret = EXIT_FAILURE;
@@ -74,7 +77,7 @@ int main(void)
     pthread_t tid;
     void *tret = NULL;
 
-    c = channelcreate(cap);
+    c = channelcreatekind(cap, kind);
     if (c == NULL)
         fail("channelcreate failed");
 
@@ -121,3 +124,16 @@ destroyc:
     channeldestroy(c);
     return ret;
 }
+
+int main(void)
+{
+    size_t i;
+
+    for (i = 0; i < NELEM(kinds); ++i)
+    {
+        if (run(kinds[i]) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
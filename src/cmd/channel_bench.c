@@ -0,0 +1,654 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bits.h"
+#include "macro.h"
+#include "printf.h"
+
+static intptr_t const nmessages = 1 << 20;
+
+static intptr_t const nroundtrips = 1 << 14;
+
+/* The producer/consumer sweep: capacities, total offered rates in messages
+ * per second (0 for flat out) and messages per paced run */
+static size_t const sweepcapacities[] = { 4, 255, 4096 };
+static double const rates[] = { 0, 1e6, 1e5 };
+static intptr_t const pacedcount = 1 << 15;
+
+/* handoff latency percentiles reported by the sweep, in nanoseconds */
+static struct
+{
+    double at;
+    char const *name;
+} const percentiles[] = {
+    { 50, "p50 ns" },
+    { 99, "p99 ns" },
+    { 99.9, "p99.9 ns" },
+    { 100, "max ns" },
+};
+
+/* 1 and 4 are the channel_block and channel_basic capacities */
+static size_t const capacities[] = { 1, 4, 64, 255, 4096 };
+
+/* messages per channelputmany/channelgetmany call, at capacity batchcap */
+static int const batches[] = { 1, 8, 32, 255 };
+static size_t const batchcap = 255;
+
+/* single-thread cost per put and get, each power of two beside a near miss */
+static size_t const opcapacities[] = { 1000, 1024, 1000000, 1 << 20 };
+static size_t const opcount = (size_t)1 << 22;
+
+/* bursts of burstlen non-blocking puts, burstgap apart, against a consumer
+ * that spends consumework iterations on each message */
+static size_t const burstcapacities[] = { 255, 4096, 65536, 1 << 20 };
+static intptr_t const burstlen = 100000;
+static int const nbursts = 10;
+static long const burstgap = 20000000;
+static int const consumework = 200;
+
+static struct
+{
+    int kind;
+    char const *name;
+    int shared; /**< Safe with several producers or consumers */
+} const kinds[] = {
+    { Clocked, "locked", 1 },
+    { Cspsc, "spsc", 0 },
+    { Cmpmc, "mpmc", 1 },
+};
+
+typedef struct Pair Pair;
+typedef struct Stage Stage;
+
+struct Pair
+{
+    Channel *ping;
+    Channel *pong;
+};
+
+/* one producer or consumer thread in the scaling sweep or batch runs */
+struct Stage
+{
+    Channel *c;
+    int batch;        /**< Messages per call in the batch runs */
+    intptr_t n;       /**< Messages to put */
+    intptr_t dropped; /**< Burst puts refused because the channel was full */
+    intptr_t got;     /**< Messages taken before the close */
+    double rate;      /**< Sweep producers: messages per second, 0 for flat out */
+    long *lat;        /**< Sweep consumers: put-to-get nanoseconds of each message */
+    pthread_t tid;
+};
+
+/* keeps stamps small enough for a 32-bit Message.value within a run */
+static time_t origin;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Nanoseconds since the bench started, carried in Message.value. */
+static intptr_t stamp(void)
+{
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (intptr_t)(ts.tv_sec - origin) * 1000000000 + ts.tv_nsec;
+}
+
+/* Sleep until message i of a stream at rate messages per second is due. */
+static void pace(double start, intptr_t i, double rate)
+{
+    double ahead;
+    struct timespec ts;
+
+    if (rate <= 0)
+        return;
+
+    ahead = start + (double)i / rate - now();
+    if (ahead <= 0)
+        return;
+
+    ts.tv_sec = (time_t)ahead;
+    ts.tv_nsec = (long)((ahead - (double)ts.tv_sec) * 1e9);
+    (void)nanosleep(&ts, NULL);
+}
+
+static int longcmp(void const *a, void const *b)
+{
+    long const x = *(long const *)a, y = *(long const *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void put(Channel *c, int tag, intptr_t value)
+{
+    Message m;
+
+    m.tag = tag;
+    m.value = value;
+    (void)channelputwait(c, &m);
+}
+
+static void *produce(void *data)
+{
+    Channel *c = data;
+    intptr_t v;
+
+    for (v = 0; v < nmessages; ++v)
+        put(c, Tsome, v);
+    put(c, Tclose, 0);
+
+    return NULL;
+}
+
+static void *echo(void *data)
+{
+    Pair *p = data;
+    Message m;
+
+    while (channelget(p->ping, &m) == 0 && m.tag == Tsome)
+        put(p->pong, Tsome, m.value);
+
+    return NULL;
+}
+
+/* Put n timestamped messages, paced to the stage's rate. */
+static void *producestage(void *data)
+{
+    Stage *s = data;
+    double start = now();
+    intptr_t v;
+
+    for (v = 0; v < s->n; ++v)
+    {
+        pace(start, v, s->rate);
+        put(s->c, Tsome, stamp());
+    }
+
+    return NULL;
+}
+
+/* Take messages until the close, recording how long each spent in transit. */
+static void *consumestage(void *data)
+{
+    Stage *s = data;
+    Message m;
+
+    while (channelget(s->c, &m) == 0)
+        s->lat[s->got++] = (long)(stamp() - m.value);
+
+    return NULL;
+}
+
+/* Put n messages and a Tclose, batch messages per call. */
+static void *producebatch(void *data)
+{
+    Stage *s = data;
+    Message *m;
+    intptr_t v = 0;
+    int i, k, rc;
+
+    m = calloc((size_t)s->batch, sizeof(*m));
+    if (m == NULL)
+        return NULL;
+
+    while (v <= s->n)
+    {
+        for (k = 0; k < s->batch && v + k <= s->n; ++k)
+        {
+            m[k].tag = (v + k < s->n) ? Tsome : Tclose;
+            m[k].value = v + k;
+        }
+
+        for (i = 0; i < k; i += rc)
+        {
+            rc = channelputmany(s->c, k - i, m + i);
+            if (rc < 0)
+                goto freem;
+        }
+        v += k;
+    }
+
+freem:
+    free(m);
+    return NULL;
+}
+
+/* One producer, one consumer: messages per second through the channel. */
+static int throughput(int kind, size_t cap, double *rate)
+{
+    int rc, ret = -1;
+    intptr_t expect = 0;
+    double start;
+    Channel *c;
+    Message m;
+    pthread_t tid;
+
+    c = channelcreatekind(cap, kind);
+    if (c == NULL)
+        return -1;
+
+    start = now();
+
+    rc = pthread_create(&tid, NULL, produce, c);
+    if (rc != 0)
+    {
+        errno = rc;
+        perror("pthread_create");
+        goto destroyc;
+    }
+
+    while (channelget(c, &m) == 0 && m.tag == Tsome)
+    {
+        if (m.value != expect++)
+            eprintf("out of order: %ld\n", (long)m.value);
+    }
+
+    (void)pthread_join(tid, NULL);
+    *rate = (double)nmessages / (now() - start);
+    ret = (expect == nmessages) ? 0 : -1;
+destroyc:
+    channeldestroy(c);
+    return ret;
+}
+
+/* Ping-pong between two threads: one-way handoff latency in nanoseconds. */
+static int latency(int kind, size_t cap, double *ns)
+{
+    int rc, ret = -1;
+    intptr_t i;
+    double start;
+    Message m;
+    Pair p;
+    pthread_t tid;
+
+    p.ping = channelcreatekind(cap, kind);
+    p.pong = channelcreatekind(cap, kind);
+    if (p.ping == NULL || p.pong == NULL)
+        goto destroyp;
+
+    rc = pthread_create(&tid, NULL, echo, &p);
+    if (rc != 0)
+    {
+        errno = rc;
+        perror("pthread_create");
+        goto destroyp;
+    }
+
+    start = now();
+    for (i = 0; i < nroundtrips; ++i)
+    {
+        put(p.ping, Tsome, i);
+        if (channelget(p.pong, &m) != 0 || m.value != i)
+            break;
+    }
+    *ns = (now() - start) * 1e9 / (double)(2 * nroundtrips);
+
+    put(p.ping, Tclose, 0);
+    (void)pthread_join(tid, NULL);
+    ret = (i == nroundtrips) ? 0 : -1;
+destroyp:
+    channeldestroy(p.pong);
+    channeldestroy(p.ping);
+    return ret;
+}
+
+/* Bursts of non-blocking puts separated by idle gaps, counting refusals. */
+static void *produceburst(void *data)
+{
+    Stage *s = data;
+    Message m;
+    struct timespec gap;
+    intptr_t v;
+    int b;
+
+    gap.tv_sec = 0;
+    gap.tv_nsec = burstgap;
+
+    m.tag = Tsome;
+    for (b = 0; b < nbursts; ++b)
+    {
+        for (v = 0; v < burstlen; ++v)
+        {
+            m.value = v;
+            if (channelput(s->c, &m) == 1)
+                s->dropped += 1;
+        }
+        (void)nanosleep(&gap, NULL);
+    }
+
+    put(s->c, Tclose, 0);
+    return NULL;
+}
+
+/* Fraction of burst messages a channel of this capacity had to refuse. */
+static int burst(int kind, size_t cap, double *dropped)
+{
+    int i, rc;
+    volatile int work;
+    Message m;
+    Stage s;
+
+    s.c = channelcreatekind(cap, kind);
+    s.dropped = 0;
+    if (s.c == NULL)
+        return -1;
+
+    rc = pthread_create(&s.tid, NULL, produceburst, &s);
+    if (rc != 0)
+    {
+        errno = rc;
+        perror("pthread_create");
+        channeldestroy(s.c);
+        return -1;
+    }
+
+    while (channelget(s.c, &m) == 0 && m.tag == Tsome)
+    {
+        for (i = 0, work = 0; i < consumework; ++i)
+            work += i;
+    }
+
+    (void)pthread_join(s.tid, NULL);
+    channeldestroy(s.c);
+    *dropped = (double)s.dropped / (double)(burstlen * nbursts);
+    return 0;
+}
+
+/* Single thread filling and draining the channel: nanoseconds per put plus get. */
+static int opcost(int kind, size_t cap, double *ns)
+{
+    size_t i, done;
+    double start;
+    Channel *c;
+    Message m;
+
+    c = channelcreatekind(cap, kind);
+    if (c == NULL)
+        return -1;
+
+    m.tag = Tsome;
+    m.value = 0;
+
+    start = now();
+    for (done = 0; done < opcount; done += cap)
+    {
+        for (i = 0; i < cap; ++i)
+            (void)channelput(c, &m);
+        for (i = 0; i < cap; ++i)
+            (void)channeltryget(c, &m);
+    }
+    *ns = (now() - start) * 1e9 / (double)done;
+
+    channeldestroy(c);
+    return 0;
+}
+
+/* One producer, one consumer, both moving batch messages per call. */
+static int batched(int kind, int batch, double *rate)
+{
+    int i, n, rc, ret = -1;
+    intptr_t expect = 0;
+    double start;
+    Message *m;
+    Stage s;
+
+    s.c = channelcreatekind(batchcap, kind);
+    s.batch = batch;
+    s.n = nmessages;
+    m = calloc((size_t)batch, sizeof(*m));
+    if (s.c == NULL || m == NULL)
+        goto freeall;
+
+    start = now();
+
+    rc = pthread_create(&s.tid, NULL, producebatch, &s);
+    if (rc != 0)
+    {
+        errno = rc;
+        perror("pthread_create");
+        goto freeall;
+    }
+
+    for (n = 0; n >= 0 && expect < nmessages;)
+    {
+        n = channelgetmany(s.c, batch, m);
+        for (i = 0; i < n && m[i].tag == Tsome; ++i)
+        {
+            if (m[i].value != expect++)
+                eprintf("out of order: %ld\n", (long)m[i].value);
+        }
+    }
+
+    /* the Tclose may come in a call of its own */
+    if (n >= 0 && (i == n))
+        (void)channelgetmany(s.c, 1, m);
+
+    (void)pthread_join(s.tid, NULL);
+    *rate = (double)nmessages / (now() - start);
+    ret = (expect == nmessages) ? 0 : -1;
+freeall:
+    channeldestroy(s.c);
+    free(m);
+    return ret;
+}
+
+/* np producers offering rate messages per second between them and nc
+ * consumers share one channel of capacity cap: messages per second overall
+ * and the handoff latency at each of the percentiles. */
+static int sweep(int kind, size_t cap, long np, long nc, double rate, double *msgs, long *pct)
+{
+    int ret = -1;
+    long i, pstarted = 0, cstarted = 0;
+    intptr_t n, got = 0;
+    size_t k;
+    double start;
+    Channel *c;
+    Stage *s;
+    long *lat = NULL;
+
+    n = ((rate > 0) ? pacedcount : nmessages) / np;
+
+    c = channelcreatekind(cap, kind);
+    s = calloc((size_t)(np + nc), sizeof(*s));
+    if (c == NULL || s == NULL)
+        goto freeall;
+
+    /* any one consumer may end up with every message */
+    for (i = 0; i < nc; ++i)
+    {
+        s[np + i].lat = malloc((size_t)(n * np) * sizeof(long));
+        if (s[np + i].lat == NULL)
+            goto freeall;
+    }
+
+    start = now();
+
+    for (; cstarted < nc; ++cstarted)
+    {
+        s[np + cstarted].c = c;
+        if (pthread_create(&s[np + cstarted].tid, NULL, consumestage, &s[np + cstarted]) != 0)
+            goto joinall;
+    }
+
+    for (; pstarted < np; ++pstarted)
+    {
+        s[pstarted].c = c;
+        s[pstarted].n = n;
+        s[pstarted].rate = rate / (double)np;
+        if (pthread_create(&s[pstarted].tid, NULL, producestage, &s[pstarted]) != 0)
+            goto joinall;
+    }
+
+    ret = 0;
+joinall:
+    for (i = 0; i < pstarted; ++i)
+        (void)pthread_join(s[i].tid, NULL);
+
+    channelclose(c);
+
+    for (i = 0; i < cstarted; ++i)
+    {
+        (void)pthread_join(s[np + i].tid, NULL);
+        got += s[np + i].got;
+    }
+
+    *msgs = (double)got / (now() - start);
+    if (ret != 0 || got != n * np)
+    {
+        ret = -1;
+        goto freeall;
+    }
+
+    /* pool every consumer's samples for the percentiles */
+    lat = malloc((size_t)got * sizeof(*lat));
+    if (lat == NULL)
+    {
+        ret = -1;
+        goto freeall;
+    }
+
+    for (i = 0, got = 0; i < nc; ++i)
+    {
+        memcpy(lat + got, s[np + i].lat, (size_t)s[np + i].got * sizeof(*lat));
+        got += s[np + i].got;
+    }
+
+    qsort(lat, (size_t)got, sizeof(*lat), longcmp);
+    for (k = 0; k < NELEM(percentiles); ++k)
+        pct[k] = lat[(size_t)((double)(got - 1) * percentiles[k].at / 100)];
+
+freeall:
+    for (i = 0; s != NULL && i < nc; ++i)
+        free(s[np + i].lat);
+    channeldestroy(c);
+    free(lat);
+    free(s);
+    return ret;
+}
+
+/* 1, 2, 4, ... up to and including max */
+static long next(long n, long max)
+{
+    return (n < max && n * 2 > max) ? max : n * 2;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t i, j, k, r;
+    long np, nc, lim, maxthreads;
+    long pct[NELEM(percentiles)];
+    double rate, ns;
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    origin = ts.tv_sec;
+
+    /* the producer/consumer sweep goes up to the core count unless told otherwise */
+    maxthreads = (argc > 1) ? atol(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (maxthreads < 1)
+        maxthreads = 1;
+
+    printf("%-8s %8s %14s %12s\n", "kind", "cap", "msgs/s", "handoff ns");
+
+    for (i = 0; i < NELEM(kinds); ++i)
+    {
+        for (j = 0; j < NELEM(capacities); ++j)
+        {
+            if (throughput(kinds[i].kind, capacities[j], &rate) != 0 || latency(kinds[i].kind, capacities[j], &ns) != 0)
+            {
+                eprintf("%s: capacity %lu failed\n", kinds[i].name, (unsigned long)capacities[j]);
+                return EXIT_FAILURE;
+            }
+
+            printf("%-8s %8lu %14.0f %12.0f\n", kinds[i].name, (unsigned long)capacities[j], rate, ns);
+        }
+    }
+
+    printf("\n%-8s %8s %14s\n", "kind", "cap", "put+get ns");
+
+    for (i = 0; i < NELEM(kinds); ++i)
+    {
+        for (j = 0; j < NELEM(opcapacities); ++j)
+        {
+            if (opcost(kinds[i].kind, opcapacities[j], &ns) != 0)
+                return EXIT_FAILURE;
+
+            printf("%-8s %8lu %14.1f\n", kinds[i].name, (unsigned long)opcapacities[j], ns);
+        }
+    }
+
+    printf("\n%-8s %8s %14s\n", "kind", "cap", "burst dropped");
+
+    for (i = 0; i < NELEM(kinds); ++i)
+    {
+        for (j = 0; j < NELEM(burstcapacities); ++j)
+        {
+            if (burst(kinds[i].kind, burstcapacities[j], &rate) != 0)
+                return EXIT_FAILURE;
+
+            printf("%-8s %8lu %13.1f%%\n", kinds[i].name, (unsigned long)burstcapacities[j], rate * 100);
+        }
+    }
+
+    printf("\n%-8s %5s %14s\n", "kind", "batch", "msgs/s");
+
+    for (i = 0; i < NELEM(kinds); ++i)
+    {
+        for (j = 0; j < NELEM(batches); ++j)
+        {
+            if (batched(kinds[i].kind, batches[j], &rate) != 0)
+            {
+                eprintf("%s: batch %d failed\n", kinds[i].name, batches[j]);
+                return EXIT_FAILURE;
+            }
+
+            printf("%-8s %5d %14.0f\n", kinds[i].name, batches[j], rate);
+        }
+    }
+
+    printf("\n%-8s %8s %4s %4s %10s %14s", "kind", "cap", "prod", "cons", "offered", "msgs/s");
+    for (k = 0; k < NELEM(percentiles); ++k)
+        printf(" %10s", percentiles[k].name);
+    printf("\n");
+
+    for (i = 0; i < NELEM(kinds); ++i)
+    {
+        /* spsc runs only its one producer and one consumer */
+        lim = kinds[i].shared ? maxthreads : 1;
+
+        for (j = 0; j < NELEM(sweepcapacities); ++j)
+        {
+            for (np = 1; np <= lim; np = next(np, lim))
+            {
+                for (nc = 1; nc <= lim; nc = next(nc, lim))
+                {
+                    for (r = 0; r < NELEM(rates); ++r)
+                    {
+                        if (sweep(kinds[i].kind, sweepcapacities[j], np, nc, rates[r], &rate, pct) != 0)
+                        {
+                            eprintf("%s: %ld producers, %ld consumers failed\n", kinds[i].name, np, nc);
+                            return EXIT_FAILURE;
+                        }
+
+                        printf("%-8s %8lu %4ld %4ld %10.0f %14.0f", kinds[i].name, (unsigned long)sweepcapacities[j], np, nc, rates[r], rate);
+                        for (k = 0; k < NELEM(percentiles); ++k)
+                            printf(" %10ld", pct[k]);
+                        printf("\n");
+                    }
+                }
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -5,6 +5,7 @@
 #include <unistd.h>
 
 #include "bits.h"
+#include "macro.h"
 #include "printf.h"
 
 extern size_t const expectedlen;
@@ -14,6 +15,8 @@ static unsigned const delay = 1U;
 
 static uint8_t const cap = 1U;
 
+static int const kinds[] = { Clocked, Cspsc, Cmpmc };
+
 static void *produce(void *data)
 {
     size_t i = 0;
@@ -23,14 +26,11 @@ static void *produce(void *data)
 
     for (i = 0; i < expectedlen; ++i)
     {
-        for (rc = 1; rc == 1;)
+        rc = channelputwait(c, (Message *)&expected[i]);
+        if (rc != 0)
         {
-            rc = channelput(c, (Message *)&expected[i]);
-            if (rc < 0)
-            {
-                eprintf("channelput failed: error %d", rc);
-                exit(EXIT_FAILURE);
-            }
+            eprintf("channelputwait failed: error %d", rc);
+            exit(EXIT_FAILURE);
         }
     }
 
@@ -65,7 +65,7 @@ static int consume(Channel *c)
     return 0;
 }
 
-int main(void)
+static int run(int kind)
 {
     int rc;
     int ret = EXIT_FAILURE;
@@ -74,7 +74,7 @@ int main(void)
     pthread_t tid;
     void *tret = NULL;
 
-    c = channelcreate(cap);
+    c = channelcreatekind(cap, kind);
     if (c == NULL)
     {
         eprintf("channelcreate failed");
@@ -121,3 +121,16 @@ destroyc:
     channeldestroy(c);
     return ret;
 }
+
+int main(void)
+{
+    size_t i;
+
+    for (i = 0; i < NELEM(kinds); ++i)
+    {
+        if (run(kinds[i]) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,129 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "bits.h"
+#include "printf.h"
+
+static size_t const cap = 4096U;
+
+static int const count = 50000;
+
+/* record i holds lengthof(i) bytes, (i + j) & 0xff at offset j; every
+ * shrinkevery-th one is reserved at the largest length and shrunk on commit */
+static size_t const maxlength = 1000U;
+static int const shrinkevery = 10;
+
+static size_t lengthof(int i)
+{
+    return (size_t)i * 37U % maxlength;
+}
+
+static void *produce(void *data)
+{
+    Channel *c = data;
+    unsigned char *p;
+    void *slot;
+    size_t j, n;
+    int i;
+
+    for (i = 0; i < count; ++i)
+    {
+        n = lengthof(i);
+        if (channelreservewait(c, (i % shrinkevery == 0) ? maxlength : n, &slot) != 0)
+            break;
+
+        p = slot;
+        for (j = 0; j < n; ++j)
+            p[j] = (unsigned char)(i + (int)j);
+
+        if (channelcommit(c, n) != 0)
+            break;
+    }
+
+    channelclose(c);
+    return NULL;
+}
+
+/* Misuse is refused and the ends of a record's life behave like a message's. */
+static int edges(void)
+{
+    int ret = 0;
+    Channel *c, *m;
+    Message msg = { Tsome, 0 };
+    void *slot;
+    size_t size;
+
+    c = channelcreatekind(cap, Cbytes);
+    m = channelcreatekind(cap, Cspsc);
+    if (c == NULL || m == NULL)
+        goto destroyc;
+
+    if (channelput(c, &msg) != -1 || channeltryget(c, &msg) != -1 || channelreserve(m, 1, &slot) != -1 ||
+        channelreserve(c, cap / 2, &slot) != -1 || channelcommit(c, 0) != -1 || channelrelease(c) != -1 ||
+        channeltryacquire(c, &slot, &size) != 1)
+        goto destroyc;
+
+    /* an empty record is still a record; a commit may not grow the reservation */
+    if (channelreserve(c, 0, &slot) != 0 || channelcommit(c, 32) != -1 || channelcommit(c, 0) != 0 ||
+        channelsize(c) != 16 || channeltryacquire(c, &slot, &size) != 0 || size != 0 || channelrelease(c) != 0 ||
+        channelsize(c) != 0)
+        goto destroyc;
+
+    channelclose(c);
+    if (channelreserve(c, 1, &slot) != 2 || channeltryacquire(c, &slot, &size) != 2)
+        goto destroyc;
+
+    ret = 1;
+destroyc:
+    channeldestroy(m);
+    channeldestroy(c);
+    return ret;
+}
+
+int main(void)
+{
+    int i = 0, rc;
+    Channel *c;
+    unsigned char *p;
+    void *slot;
+    size_t j, size;
+    pthread_t tid;
+
+    if (!edges())
+        return EXIT_FAILURE;
+
+    c = channelcreatekind(cap, Cbytes);
+    if (c == NULL || pthread_create(&tid, NULL, produce, c) != 0)
+        return EXIT_FAILURE;
+
+    while ((rc = channelacquire(c, &slot, &size)) == 0)
+    {
+        p = slot;
+        if (size != lengthof(i) || (uintptr_t)slot % 16 != 0)
+        {
+            eprintf("record %d: %lu bytes, expected %lu\n", i, (unsigned long)size, (unsigned long)lengthof(i));
+            break;
+        }
+
+        for (j = 0; j < size; ++j)
+        {
+            if (p[j] != (unsigned char)(i + (int)j))
+            {
+                eprintf("record %d: byte %lu is %u\n", i, (unsigned long)j, p[j]);
+                break;
+            }
+        }
+        if (j < size || channelrelease(c) != 0)
+            break;
+
+        i += 1;
+    }
+
+    /* a consumer that gave up must not leave the producer waiting */
+    channelclose(c);
+    (void)pthread_join(tid, NULL);
+    channeldestroy(c);
+
+    return (rc == 2 && i == count) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,173 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bits.h"
+#include "macro.h"
+#include "printf.h"
+
+static size_t const cap = 4U;
+
+/* long enough for the helper thread to be asleep in the channel */
+static long const settle = 50000000;
+
+static int const kinds[] = { Clocked, Cspsc, Cmpmc };
+
+typedef struct Blocked Blocked;
+
+/* a thread stuck in a channel call, and what the call returned */
+struct Blocked
+{
+    Channel *c;
+    int rc;
+    pthread_t tid;
+};
+
+static void nap(void)
+{
+    struct timespec ts;
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = settle;
+    (void)nanosleep(&ts, NULL);
+}
+
+static void *blockget(void *data)
+{
+    Blocked *b = data;
+    Message m;
+
+    b->rc = channelget(b->c, &m);
+    return NULL;
+}
+
+static void *blockput(void *data)
+{
+    Blocked *b = data;
+    Message m = { Tsome, 0 };
+
+    b->rc = channelputwait(b->c, &m);
+    return NULL;
+}
+
+/* Messages queued before the close are still delivered; then gets report 2. */
+static int drain(int kind)
+{
+    int ret = 0;
+    intptr_t v;
+    Channel *c;
+    Message m = { Tsome, 0 };
+    Message out[4];
+
+    c = channelcreatekind(cap, kind);
+    if (c == NULL)
+        return 0;
+
+    for (v = 0; v < 3; ++v)
+    {
+        m.value = v;
+        if (channelput(c, &m) != 0)
+            goto destroyc;
+    }
+
+    channelclose(c);
+
+    if (channelput(c, &m) != 2 || channelputwait(c, &m) != 2 || channelputmany(c, 1, &m) != 0)
+    {
+        eprintf("kind %d: put after close\n", kind);
+        goto destroyc;
+    }
+
+    if (channelget(c, &out[0]) != 0 || out[0].value != 0 || channelgetmany(c, 4, out) != 2 || out[1].value != 2)
+    {
+        eprintf("kind %d: drain after close\n", kind);
+        goto destroyc;
+    }
+
+    if (channelget(c, &m) != 2 || channeltryget(c, &m) != 2 || channelgetmany(c, 4, out) != 0)
+    {
+        eprintf("kind %d: get after drain\n", kind);
+        goto destroyc;
+    }
+
+    ret = 1;
+destroyc:
+    channeldestroy(c);
+    return ret;
+}
+
+/* A getter on an empty channel and a putter on a full one both wake on close. */
+static int wake(int kind, void *(*fn)(void *), int fill)
+{
+    int i, ret = 0;
+    Message m = { Tsome, 0 };
+    Blocked b;
+
+    b.c = channelcreatekind(cap, kind);
+    b.rc = -1;
+    if (b.c == NULL)
+        return 0;
+
+    for (i = 0; fill && i < (int)cap; ++i)
+        (void)channelput(b.c, &m);
+
+    if (pthread_create(&b.tid, NULL, fn, &b) != 0)
+        goto destroyc;
+
+    nap();
+    channelclose(b.c);
+    (void)pthread_join(b.tid, NULL);
+
+    if (b.rc != 2)
+    {
+        eprintf("kind %d: blocked call returned %d after close\n", kind, b.rc);
+        goto destroyc;
+    }
+
+    ret = 1;
+destroyc:
+    channeldestroy(b.c);
+    return ret;
+}
+
+/* channeldestroy with a getter asleep and no producer finishes and releases it. */
+static int destroy(int kind)
+{
+    Blocked b;
+
+    b.c = channelcreatekind(cap, kind);
+    b.rc = -1;
+    if (b.c == NULL)
+        return 0;
+
+    if (pthread_create(&b.tid, NULL, blockget, &b) != 0)
+    {
+        channeldestroy(b.c);
+        return 0;
+    }
+
+    nap();
+    channeldestroy(b.c);
+    (void)pthread_join(b.tid, NULL);
+
+    if (b.rc != 2)
+    {
+        eprintf("kind %d: getter returned %d from destroy\n", kind, b.rc);
+        return 0;
+    }
+
+    return 1;
+}
+
+int main(void)
+{
+    size_t i;
+
+    for (i = 0; i < NELEM(kinds); ++i)
+    {
+        if (!drain(kinds[i]) || !wake(kinds[i], blockget, 0) || !wake(kinds[i], blockput, 1) || !destroy(kinds[i]))
+            return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
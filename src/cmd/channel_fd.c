@@ -0,0 +1,158 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bits.h"
+#include "macro.h"
+#include "printf.h"
+
+static size_t const cap = 4U;
+
+static int const count = 1000;
+
+/* the producer pauses this long every pauseevery messages, in nanoseconds,
+ * so the loop below sees the channel run dry and the fd go quiet */
+static long const pausens = 100000;
+static int const pauseevery = 100;
+
+static int const kinds[] = { Clocked, Cspsc, Cmpmc };
+
+static void *produce(void *data)
+{
+    Channel *c = data;
+    Message m = { Tsome, 0 };
+    struct timespec ts;
+    int i;
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = pausens;
+
+    for (i = 0; i < count; ++i)
+    {
+        if (i % pauseevery == 0)
+            (void)nanosleep(&ts, NULL);
+
+        m.value = i;
+        if (channelputwait(c, &m) != 0)
+            break;
+    }
+
+    channelclose(c);
+    return NULL;
+}
+
+/* Not readable while empty, readable with a message queued, quiet again once drained. */
+static int idle(int kind)
+{
+    int ret = 0, ep = -1;
+    Channel *c;
+    Message m = { Tsome, 0 };
+    struct epoll_event ev;
+
+    c = channelcreatekind(cap, kind);
+    if (c == NULL)
+        return 0;
+
+    /* a message queued before the fd exists shows at once */
+    if (channelput(c, &m) != 0 || channelfd(c) < 0 || channelfd(c) != channelfd(c))
+        goto destroyc;
+
+    ep = epoll_create1(EPOLL_CLOEXEC);
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    if (ep < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, channelfd(c), &ev) != 0)
+        goto destroyc;
+
+    if (epoll_wait(ep, &ev, 1, 0) != 1 || channeltryget(c, &m) != 0 || channeltryget(c, &m) != 1)
+    {
+        eprintf("kind %d: queued message not reported\n", kind);
+        goto destroyc;
+    }
+
+    if (epoll_wait(ep, &ev, 1, 0) != 0)
+    {
+        eprintf("kind %d: fd readable on an empty channel\n", kind);
+        goto destroyc;
+    }
+
+    ret = 1;
+destroyc:
+    if (ep >= 0)
+        (void)close(ep);
+    channeldestroy(c);
+    return ret;
+}
+
+/* An epoll loop drains a channel fed by another thread until it is closed. */
+static int loop(int kind)
+{
+    int rc, ret = 0, ep;
+    intptr_t expect = 0;
+    Channel *c;
+    Message m;
+    struct epoll_event ev;
+    pthread_t tid;
+
+    c = channelcreatekind(cap, kind);
+    if (c == NULL)
+        return 0;
+
+    ep = epoll_create1(EPOLL_CLOEXEC);
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = c;
+    if (ep < 0 || channelfd(c) < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, channelfd(c), &ev) != 0)
+    {
+        perror("epoll");
+        goto destroyc;
+    }
+
+    if (pthread_create(&tid, NULL, produce, c) != 0)
+        goto closeep;
+
+    for (rc = 1; rc != 2;)
+    {
+        if (epoll_wait(ep, &ev, 1, -1) != 1)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        /* edge-triggered: take everything before waiting again */
+        while ((rc = channeltryget(ev.data.ptr, &m)) == 0)
+        {
+            if (m.value != expect++)
+            {
+                eprintf("kind %d: got %" PRIdPTR ", expected %" PRIdPTR "\n", kind, m.value, expect - 1);
+                rc = 2;
+                break;
+            }
+        }
+    }
+
+    (void)pthread_join(tid, NULL);
+    ret = (expect == count);
+closeep:
+    (void)close(ep);
+destroyc:
+    channeldestroy(c);
+    return ret;
+}
+
+int main(void)
+{
+    size_t i;
+
+    for (i = 0; i < NELEM(kinds); ++i)
+    {
+        if (!idle(kinds[i]) || !loop(kinds[i]))
+            return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,129 @@
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "bits.h"
+#include "macro.h"
+#include "printf.h"
+
+static int const count = 1000;
+
+static uint8_t const cap = 4U;
+
+/* the consumer asks for more than the capacity to exercise partial batches */
+static int const getbatch = 5;
+
+static int const kinds[] = { Clocked, Cspsc, Cmpmc };
+
+static void fail(char const *msg, int rc)
+{
+    eprintf("%s: %d\n", msg, rc);
+    exit(EXIT_FAILURE);
+}
+
+static void *produce(void *data)
+{
+    int i, k, rc;
+    intptr_t v;
+    Channel *c;
+    Message m[7];
+
+    assert(data != NULL);
+
+    c = data;
+
+    /* batches of 1 to 7 messages, the last one ending in Tclose */
+    for (v = 0, k = 1; v <= count; v += k, k = (k % (int)NELEM(m)) + 1)
+    {
+        for (i = 0; i < k; ++i)
+        {
+            m[i].tag = (v + i < count) ? Tsome : Tclose;
+            m[i].value = v + i;
+            if (m[i].tag == Tclose)
+            {
+                k = i + 1;
+                break;
+            }
+        }
+
+        for (i = 0; i < k; i += rc)
+        {
+            rc = channelputmany(c, k - i, m + i);
+            if (rc <= 0)
+                fail("channelputmany failed", rc);
+        }
+    }
+
+    return NULL;
+}
+
+static int run(int kind)
+{
+    int i, n, rc;
+    int ret = EXIT_FAILURE;
+    intptr_t expect = 0;
+    Channel *c;
+    Message m[5];
+    pthread_t tid;
+
+    assert(NELEM(m) == (size_t)getbatch);
+
+    c = channelcreatekind(cap, kind);
+    if (c == NULL)
+    {
+        eprintf("channelcreatekind failed\n");
+        return EXIT_FAILURE;
+    }
+
+    if (channelputmany(c, 0, m) != -1 || channelgetmany(c, 0, m) != -1)
+        goto destroyc;
+
+    rc = pthread_create(&tid, NULL, produce, c);
+    if (rc != 0)
+    {
+        errno = rc;
+        perror("pthread_create");
+        goto destroyc;
+    }
+
+    for (;;)
+    {
+        n = channelgetmany(c, getbatch, m);
+        if (n <= 0 || n > getbatch)
+            fail("channelgetmany failed", n);
+
+        for (i = 0; i < n; ++i)
+        {
+            if (m[i].value != expect++)
+            {
+                eprintf("kind %d: got %" PRIdPTR ", expected %" PRIdPTR "\n", kind, m[i].value, expect - 1);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        if (m[n - 1].tag == Tclose)
+            break;
+    }
+
+    (void)pthread_join(tid, NULL);
+    if (expect == count + 1)
+        ret = EXIT_SUCCESS;
+destroyc:
+    channeldestroy(c);
+    return ret;
+}
+
+int main(void)
+{
+    size_t i;
+
+    for (i = 0; i < NELEM(kinds); ++i)
+    {
+        if (run(kinds[i]) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,198 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bits.h"
+#include "macro.h"
+#include "printf.h"
+
+static size_t const cap = 4U;
+
+static int const count = 1000;
+
+/* timeouts used below, in nanoseconds */
+static long const shortwait = 20000000;
+
+static int const kinds[] = { Clocked, Cspsc, Cmpmc };
+
+typedef struct Producer Producer;
+
+/* one producer per channel, each sending count values and closing */
+struct Producer
+{
+    Channel *c;
+    intptr_t base;
+    pthread_t tid;
+};
+
+static void after(struct timespec *ts, long ns)
+{
+    (void)clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_nsec += ns;
+    while (ts->tv_nsec >= 1000000000L)
+    {
+        ts->tv_nsec -= 1000000000L;
+        ts->tv_sec += 1;
+    }
+}
+
+static int passed(struct timespec const *deadline)
+{
+    struct timespec now;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec > deadline->tv_sec || (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+static void *produce(void *data)
+{
+    Producer *p = data;
+    Message m = { Tsome, 0 };
+    int i;
+
+    for (i = 0; i < count; ++i)
+    {
+        m.value = p->base + i;
+        if (channelputwait(p->c, &m) != 0)
+            break;
+    }
+
+    channelclose(p->c);
+    return NULL;
+}
+
+/* Timed gets and selects on idle channels give up at the deadline. */
+static int timeouts(int kind)
+{
+    int ret = 0;
+    Channel *c;
+    Message m = { Tsome, 0 };
+    Select s[2];
+    struct timespec deadline;
+
+    c = channelcreatekind(cap, kind);
+    if (c == NULL)
+        return 0;
+
+    after(&deadline, shortwait);
+    if (channelgettimed(c, &m, &deadline) != 1 || !passed(&deadline))
+    {
+        eprintf("kind %d: timed get on an empty channel\n", kind);
+        goto destroyc;
+    }
+
+    (void)channelput(c, &m);
+    after(&deadline, shortwait);
+    if (channelgettimed(c, &m, &deadline) != 0)
+    {
+        eprintf("kind %d: timed get with a message\n", kind);
+        goto destroyc;
+    }
+
+    /* two puts on the full channel time out; turning one into a get fires it */
+    while (channelput(c, &m) == 0)
+        ;
+    s[0].c = c;
+    s[0].op = Sput;
+    s[0].m = &m;
+    s[1] = s[0];
+    after(&deadline, shortwait);
+    if (channelselect(s, 2, &deadline) != -1 || errno != ETIMEDOUT || !passed(&deadline))
+    {
+        eprintf("kind %d: select on a full channel\n", kind);
+        goto destroyc;
+    }
+
+    s[1].op = Sget;
+    if (channelselect(s, 2, &deadline) != 1 || s[1].rc != 0)
+    {
+        eprintf("kind %d: select with a ready get\n", kind);
+        goto destroyc;
+    }
+
+    ret = 1;
+destroyc:
+    channeldestroy(c);
+    return ret;
+}
+
+/* One thread multiplexes a channel per kind, each fed by its own producer,
+ * until all are closed and drained; each stream must arrive in order. */
+static int multiplex(void)
+{
+    int i, n, started, ret = 0;
+    intptr_t expect[NELEM(kinds)];
+    Message m[NELEM(kinds)];
+    Producer p[NELEM(kinds)];
+    Select s[NELEM(kinds)], t;
+
+    for (started = 0; started < (int)NELEM(kinds); ++started)
+    {
+        n = started;
+        p[n].c = channelcreatekind(cap, kinds[n]);
+        p[n].base = (intptr_t)n * count;
+        if (p[n].c == NULL || pthread_create(&p[n].tid, NULL, produce, &p[n]) != 0)
+        {
+            channeldestroy(p[n].c);
+            goto joinp;
+        }
+
+        expect[n] = p[n].base;
+        s[n].c = p[n].c;
+        s[n].op = Sget;
+        s[n].m = &m[n];
+    }
+
+    /* closed cases move to the end of the array and drop out */
+    for (i = (int)NELEM(kinds); i > 0;)
+    {
+        n = channelselect(s, i, NULL);
+        if (n < 0 || s[n].rc < 0)
+        {
+            eprintf("select failed\n");
+            goto joinp;
+        }
+
+        if (s[n].rc == 2)
+        {
+            t = s[n];
+            s[n] = s[i - 1];
+            s[--i] = t;
+            continue;
+        }
+
+        if (s[n].m->value != expect[s[n].m - m]++)
+        {
+            eprintf("channel %d: got %" PRIdPTR "\n", (int)(s[n].m - m), s[n].m->value);
+            goto joinp;
+        }
+    }
+
+    ret = 1;
+    for (i = 0; i < (int)NELEM(kinds); ++i)
+        ret = ret && expect[i] == p[i].base + count;
+
+joinp:
+    for (i = 0; i < started; ++i)
+    {
+        channelclose(p[i].c);
+        (void)pthread_join(p[i].tid, NULL);
+        channeldestroy(p[i].c);
+    }
+    return ret;
+}
+
+int main(void)
+{
+    size_t i;
+
+    for (i = 0; i < NELEM(kinds); ++i)
+    {
+        if (!timeouts(kinds[i]))
+            return EXIT_FAILURE;
+    }
+
+    return multiplex() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
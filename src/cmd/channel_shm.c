@@ -0,0 +1,106 @@
+#include <inttypes.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bits.h"
+#include "macro.h"
+#include "printf.h"
+
+static size_t const cap = 16U;
+
+static int const count = 10000;
+
+static int const kinds[] = { Clocked, Cspsc, Cmpmc };
+
+/* Child: map the channel afresh from the fd and send count messages. */
+static void produce(int fd)
+{
+    Channel *c;
+    Message m = { Tsome, 0 };
+    int i;
+
+    c = channelmap(fd);
+    if (c == NULL)
+        _exit(EXIT_FAILURE);
+
+    for (i = 0; i < count; ++i)
+    {
+        m.value = i;
+        if (channelputwait(c, &m) != 0)
+            _exit(EXIT_FAILURE);
+    }
+
+    channelclose(c);
+    channeldestroy(c);
+    _exit(EXIT_SUCCESS);
+}
+
+static int run(int kind)
+{
+    int fd, rc, status, ret = 0;
+    intptr_t expect = 0;
+    Channel *c;
+    Message m;
+    pid_t pid;
+
+    c = channelshm(cap, kind, &fd);
+    if (c == NULL)
+    {
+        perror("channelshm");
+        return 0;
+    }
+
+    if (channelfd(c) != -1)
+        goto destroyc;
+
+    pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        goto destroyc;
+    }
+    if (pid == 0)
+        produce(fd);
+
+    while ((rc = channelget(c, &m)) == 0)
+    {
+        if (m.value != expect++)
+        {
+            eprintf("kind %d: got %" PRIdPTR ", expected %" PRIdPTR "\n", kind, m.value, expect - 1);
+            break;
+        }
+    }
+
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+    {
+        eprintf("kind %d: producer failed\n", kind);
+        goto destroyc;
+    }
+
+    ret = (rc == 2 && expect == count);
+destroyc:
+    channeldestroy(c);
+    (void)close(fd);
+    return ret;
+}
+
+int main(void)
+{
+    int p[2];
+    size_t i;
+
+    /* an fd that does not hold a channel is refused */
+    if (pipe(p) != 0 || channelmap(p[0]) != NULL)
+        return EXIT_FAILURE;
+    (void)close(p[0]);
+    (void)close(p[1]);
+
+    for (i = 0; i < NELEM(kinds); ++i)
+    {
+        if (!run(kinds[i]))
+            return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
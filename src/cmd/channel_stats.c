@@ -0,0 +1,116 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bits.h"
+#include "macro.h"
+#include "printf.h"
+
+static size_t const cap = 8U;
+
+/* how long the getter is left blocked, in nanoseconds */
+static long const blockns = 20000000;
+
+static int const kinds[] = { Clocked, Cspsc, Cmpmc };
+
+static void *blockget(void *data)
+{
+    Channel *c = data;
+    Message m;
+
+    (void)channelget(c, &m);
+    return NULL;
+}
+
+static int run(int kind)
+{
+    int ret = 0;
+    size_t i;
+    uint64_t n;
+    Channel *c;
+    Channelstats s;
+    Message m = { Tsome, 0 };
+    struct timespec ts;
+    pthread_t tid;
+
+    c = channelcreatekind(cap, kind);
+    if (c == NULL)
+        return 0;
+
+    /* fill until refused, then drain until empty */
+    while (channelput(c, &m) == 0)
+        ;
+
+    if (channelstats(c, &s) != 0 || s.capacity != cap || s.size != cap)
+    {
+        eprintf("kind %d: capacity %lu, size %lu\n", kind, (unsigned long)s.capacity, (unsigned long)s.size);
+        goto destroyc;
+    }
+
+    while (channeltryget(c, &m) == 0)
+        ;
+
+    if (pthread_create(&tid, NULL, blockget, c) != 0)
+        goto destroyc;
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = blockns;
+    (void)nanosleep(&ts, NULL);
+    (void)channelputwait(c, &m);
+    (void)pthread_join(tid, NULL);
+
+    if (channelstats(c, &s) != 0 || s.size != 0)
+        goto destroyc;
+
+#ifdef BITS_STATS
+    for (i = 0, n = 0; i < NELEM(s.depth); ++i)
+        n += s.depth[i];
+
+    /* depths 1 to 8 land in buckets 0, 1, 1, 2, 2, 2, 2 and 3, then the
+     * blocked getter's message at depth 1 */
+    if (s.puts != cap + 1 || s.gets != cap + 1 || n != s.puts || s.depth[0] != 2 || s.depth[1] != 2 ||
+        s.depth[2] != 4 || s.depth[3] != 1)
+    {
+        eprintf("kind %d: puts %lu, gets %lu, depth total %lu\n", kind, (unsigned long)s.puts, (unsigned long)s.gets,
+                (unsigned long)n);
+        goto destroyc;
+    }
+
+    if (s.full != 1 || s.empty != 2 || s.getwaitns < (uint64_t)blockns / 2 || s.putwaitns != 0)
+    {
+        eprintf("kind %d: full %lu, empty %lu, getwaitns %lu\n", kind, (unsigned long)s.full, (unsigned long)s.empty,
+                (unsigned long)s.getwaitns);
+        goto destroyc;
+    }
+#else
+    for (i = 0, n = 0; i < NELEM(s.depth); ++i)
+        n += s.depth[i];
+
+    if (s.puts != 0 || s.gets != 0 || s.full != 0 || s.empty != 0 || s.getwaitns != 0 || s.contended != 0 || n != 0)
+    {
+        eprintf("kind %d: counters set without BITS_STATS\n", kind);
+        goto destroyc;
+    }
+#endif
+
+    ret = 1;
+destroyc:
+    channeldestroy(c);
+    return ret;
+}
+
+int main(void)
+{
+    size_t i;
+
+    if (channelstats(NULL, NULL) != -1)
+        return EXIT_FAILURE;
+
+    for (i = 0; i < NELEM(kinds); ++i)
+    {
+        if (!run(kinds[i]))
+            return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
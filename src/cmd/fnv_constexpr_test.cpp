@@ -0,0 +1,85 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "bits.hpp"
+
+using namespace bits::literals;
+
+// https://datatracker.ietf.org/doc/html/draft-eastlake-fnv-03#page-15
+static_assert(""_fnv == 0xaf63bd4c8601b7df);
+static_assert("a"_fnv == 0x089be207b544f1e4);
+static_assert("foobar"_fnv == 0x34531ca7168b8f38);
+static_assert(bits::fnvkey("foobar") == "foobar"_fnv);
+static_assert(bits::fnv(0, "") == bits::fnvoffsetbasis);
+static_assert("foobar"_key.hash == "foobar"_fnv);
+
+namespace
+{
+
+char const *const keys[] = { "", "a", "foobar", "\xff\x80 high bytes", "put", "get" };
+
+enum class Command
+{
+    Put,
+    Get,
+    Unknown,
+};
+
+Command parse(char const *cmd)
+{
+    switch (bits::fnvkey(cmd))
+    {
+    case "put"_fnv:
+        return std::strcmp(cmd, "put") == 0 ? Command::Put : Command::Unknown;
+    case "get"_fnv:
+        return std::strcmp(cmd, "get") == 0 ? Command::Get : Command::Unknown;
+    default:
+        return Command::Unknown;
+    }
+}
+
+int fail(char const *msg)
+{
+    std::fprintf(stderr, "FAIL: %s\n", msg);
+    return EXIT_FAILURE;
+}
+
+} // namespace
+
+int main()
+{
+    for (char const *key : keys)
+    {
+        size_t len = std::strlen(key) + 1;
+        if (bits::fnv(len, key) != fnv(len, reinterpret_cast<unsigned char const *>(key)))
+            return fail("bits::fnv differs from fnv");
+    }
+
+    if (parse("put") != Command::Put || parse("get") != Command::Get || parse("del") != Command::Unknown)
+        return fail("parse");
+
+    Table *t = tablecreate(8);
+    if (t == nullptr)
+        return fail("tablecreate");
+    defer({ tabledestroy(t, nullptr); });
+
+    static int value = 42;
+    if (tableput(t, "answer", &value) != 0)
+        return fail("tableput");
+
+    constexpr bits::Key answer = "answer"_key;
+    if (bits::tableget(t, answer) != &value || bits::tableget(t, "question"_key) != nullptr)
+        return fail("tableget with precomputed hash");
+
+    Frozen *f = tablefreeze(t);
+    if (f == nullptr)
+        return fail("tablefreeze");
+    defer({ frozendestroy(f); });
+
+    if (bits::frozenget(f, answer) != &value || bits::frozenget(f, "question"_key) != nullptr)
+        return fail("frozenget with precomputed hash");
+
+    return EXIT_SUCCESS;
+}
@@ -26,6 +26,63 @@ static int check(char const *input, uint64_t const expected, uint64_t const actu
     return 0;
 }
 
+/* Hash input one byte at a time, then in two halves, returning 0 if the results differ. */
+static uint64_t streamed(char const *input)
+{
+    size_t const len = strlen(input) + 1;
+    size_t i;
+    Fnv bytewise, halves;
+
+    fnvinit(&bytewise);
+    for (i = 0; i < len; ++i)
+        fnvupdate(&bytewise, 1, (unsigned char const *)input + i);
+
+    fnvinit(&halves);
+    fnvupdate(&halves, len / 2, (unsigned char const *)input);
+    fnvupdate(&halves, 0, NULL);
+    fnvupdate(&halves, len - len / 2, (unsigned char const *)input + len / 2);
+
+    return (fnvfinal(&bytewise) == fnvfinal(&halves)) ? fnvfinal(&halves) : 0;
+}
+
+/* Check fnvmany against fnv over enough inputs of mixed lengths to reach every lane width. */
+static int many(void)
+{
+    enum
+    {
+        ninputs = 87,
+        maxlen = 67
+    };
+    static unsigned char data[ninputs][maxlen];
+    unsigned char const *ptrs[ninputs];
+    size_t lens[ninputs];
+    uint64_t out[ninputs];
+    size_t i, j;
+
+    for (i = 0; i < ninputs; ++i)
+    {
+        for (j = 0; j < maxlen; ++j)
+            data[i][j] = (unsigned char)(i * 31 + j * 7);
+        ptrs[i] = data[i];
+        lens[i] = maxlen - (i * 5) % 11;
+    }
+    lens[ninputs - 4] = 0;
+    lens[ninputs - 1] = 0;
+
+    fnvmany(ninputs, lens, ptrs, out);
+
+    for (i = 0; i < ninputs; ++i)
+    {
+        if (out[i] != fnv(lens[i], ptrs[i]))
+        {
+            eprintf("fnvmany: input %lu of length %lu differs from fnv\n", (unsigned long)i, (unsigned long)lens[i]);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
 int main(void)
 {
     size_t i;
@@ -41,6 +98,14 @@ int main(void)
         actual = fnv(strlen(input) + 1, (unsigned char const *)input);
         if (!check(input, expected, actual))
             return EXIT_FAILURE;
+
+        actual = streamed(input);
+        if (!check(input, expected, actual))
+            return EXIT_FAILURE;
     }
+
+    if (!many())
+        return EXIT_FAILURE;
+
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,110 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bits.h"
+#include "printf.h"
+
+static size_t const nkeys = (size_t)1 << 20;
+
+static int const rounds = 5;
+
+static size_t const lengths[] = { 8, 16, 32, 64, 256, 0 };
+
+static double now(void)
+{
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Run both hashers over nkeys keys of length keylen and report the best round of each. */
+static int bench(size_t keylen, unsigned char *data, unsigned char const **ptrs, size_t *lens, uint64_t *scalar, uint64_t *batch)
+{
+    size_t i;
+    int r;
+    double start, tscalar = 0, tbatch = 0, elapsed;
+
+    for (i = 0; i < nkeys; ++i)
+    {
+        ptrs[i] = data + i * keylen;
+        lens[i] = keylen;
+    }
+
+    for (r = 0; r < rounds; ++r)
+    {
+        start = now();
+        for (i = 0; i < nkeys; ++i)
+            scalar[i] = fnv(lens[i], ptrs[i]);
+        elapsed = now() - start;
+        if (r == 0 || elapsed < tscalar)
+            tscalar = elapsed;
+
+        start = now();
+        fnvmany(nkeys, lens, ptrs, batch);
+        elapsed = now() - start;
+        if (r == 0 || elapsed < tbatch)
+            tbatch = elapsed;
+    }
+
+    if (memcmp(scalar, batch, nkeys * sizeof(*batch)) != 0)
+    {
+        eprintf("fnvmany and fnv differ for keys of length %lu\n", (unsigned long)keylen);
+        return 0;
+    }
+
+    printf("%6lu %12.1f %12.1f %12.3f %12.3f %8.2fx\n",
+           (unsigned long)keylen,
+           (double)nkeys / tscalar / 1e6,
+           (double)nkeys / tbatch / 1e6,
+           (double)(nkeys * keylen) / tscalar / 1e9,
+           (double)(nkeys * keylen) / tbatch / 1e9,
+           tscalar / tbatch);
+    return 1;
+}
+
+int main(void)
+{
+    int ret = EXIT_FAILURE;
+    size_t i, maxlen = 0;
+    unsigned char *data;
+    unsigned char const **ptrs;
+    size_t *lens;
+    uint64_t *scalar, *batch;
+
+    for (i = 0; lengths[i] != 0; ++i)
+        if (lengths[i] > maxlen)
+            maxlen = lengths[i];
+
+    data = malloc(nkeys * maxlen);
+    ptrs = malloc(nkeys * sizeof(*ptrs));
+    lens = malloc(nkeys * sizeof(*lens));
+    scalar = malloc(nkeys * sizeof(*scalar));
+    batch = malloc(nkeys * sizeof(*batch));
+    if (data == NULL || ptrs == NULL || lens == NULL || scalar == NULL || batch == NULL)
+    {
+        eprintf("allocation failed\n");
+        goto freeall;
+    }
+
+    srand(1);
+    for (i = 0; i < nkeys * maxlen; ++i)
+        data[i] = (unsigned char)rand();
+
+    printf("%6s %12s %12s %12s %12s %9s\n", "keylen", "fnv Mkey/s", "many Mkey/s", "fnv GB/s", "many GB/s", "speedup");
+    for (i = 0; lengths[i] != 0; ++i)
+        if (!bench(lengths[i], data, ptrs, lens, scalar, batch))
+            goto freeall;
+
+    ret = EXIT_SUCCESS;
+freeall:
+    free(data);
+    free(ptrs);
+    free(lens);
+    free(scalar);
+    free(batch);
+    return ret;
+}
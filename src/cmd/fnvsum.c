@@ -0,0 +1,401 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bits.h"
+#include "printf.h"
+
+/* read size for pipes and other files that cannot be mapped */
+static size_t const bufsize = (size_t)1 << 20;
+
+/* files are mapped a window at a time to bound address space and resident pages */
+static size_t const window = (size_t)1 << 30;
+
+/* default tree chunk; large enough that per-chunk dispatch cost is noise */
+static size_t const defaultchunk = (size_t)1 << 20;
+
+/* worker count for tree hashing (-j), zero for the flat hash */
+static long jobs = 0;
+
+/* tree chunk size (-b) */
+static size_t chunk = 0;
+
+/* bytes hashed in tree mode, for the throughput report */
+static uintmax_t total = 0;
+
+typedef struct Tree Tree;
+
+/* one mapped file being hashed by a set of workers */
+struct Tree
+{
+    unsigned char const *base; /**< Start of the mapping */
+    size_t size;               /**< Length of the file */
+    size_t pagesize;           /**< For aligning readahead hints */
+    uint64_t *hashes;          /**< Hash of each chunk, filled in by the workers */
+    Channel *c;                /**< Chunk indices to hash, closed when all are queued */
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Fold a chunk hash into the root: the root is fnv over the little-endian chunk hashes in order. */
+static void feed(Fnv *root, uint64_t h)
+{
+    unsigned char le[8];
+    unsigned i;
+
+    for (i = 0; i < sizeof(le); ++i)
+        le[i] = (unsigned char)(h >> (8 * i));
+
+    fnvupdate(root, sizeof(le), le);
+}
+
+static int dispatch(Channel *c, size_t value)
+{
+    Message m;
+
+    m.tag = Tsome;
+    m.value = (intptr_t)value;
+
+    return channelputwait(c, &m);
+}
+
+static void *treeworker(void *data)
+{
+    Tree *t = data;
+    Message m;
+    size_t i, off, len, pad;
+
+    while (channelget(t->c, &m) == 0)
+    {
+        i = (size_t)m.value;
+        off = i * chunk;
+        len = (t->size - off < chunk) ? t->size - off : chunk;
+
+        /* start readahead for the whole chunk rather than faulting it in a page at a time */
+        pad = off % t->pagesize;
+        (void)madvise((void *)(t->base + off - pad), len + pad, MADV_WILLNEED);
+        t->hashes[i] = fnv(len, t->base + off);
+    }
+
+    return NULL;
+}
+
+static int treemapped(int fd, size_t size, Fnv *root)
+{
+    int rc = -1;
+    size_t i, n, nworkers;
+    long k, started = 0;
+    pthread_t *tids = NULL;
+    void *p;
+    Tree t;
+
+    p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+        return 1;
+
+    n = (size + chunk - 1) / chunk;
+    nworkers = ((size_t)jobs < n) ? (size_t)jobs : n;
+
+    t.base = p;
+    t.size = size;
+    t.pagesize = (size_t)sysconf(_SC_PAGESIZE);
+    t.hashes = calloc(n, sizeof(*t.hashes));
+    t.c = channelcreate(nworkers * 2);
+    tids = calloc(nworkers, sizeof(*tids));
+    if (t.hashes == NULL || t.c == NULL || tids == NULL)
+        goto freeall;
+
+    for (; (size_t)started < nworkers; ++started)
+    {
+        if (pthread_create(&tids[started], NULL, treeworker, &t) != 0)
+            break;
+    }
+
+    /* no workers at all: hash the chunks here rather than fail */
+    if (started == 0)
+    {
+        for (i = 0; i < n; ++i)
+            t.hashes[i] = fnv((i + 1 < n) ? chunk : size - i * chunk, t.base + i * chunk);
+    }
+
+    for (i = 0; started > 0 && i < n; ++i)
+    {
+        if (dispatch(t.c, i) != 0)
+            break;
+    }
+
+    /* workers drain what is queued, then see the close */
+    channelclose(t.c);
+
+    for (k = 0; k < started; ++k)
+        (void)pthread_join(tids[k], NULL);
+
+    if (started > 0 && i < n)
+        goto freeall;
+
+    for (i = 0; i < n; ++i)
+        feed(root, t.hashes[i]);
+
+    total += size;
+    rc = 0;
+freeall:
+    channeldestroy(t.c);
+    free(tids);
+    free(t.hashes);
+    (void)munmap(p, size);
+    return rc;
+}
+
+/* Tree hash of an unmappable file: the same root, computed one chunk at a time. */
+static int treeread(int fd, unsigned char *buf, Fnv *root)
+{
+    size_t have = 0;
+    ssize_t n;
+
+    for (;;)
+    {
+        n = read(fd, buf + have, chunk - have);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        have += (size_t)n;
+        if (have == chunk || (n == 0 && have > 0))
+        {
+            feed(root, fnv(have, buf));
+            total += have;
+            have = 0;
+        }
+
+        if (n == 0)
+            return 0;
+    }
+}
+
+static int hashmapped(int fd, off_t size, Fnv *s)
+{
+    off_t off;
+    size_t len;
+    void *p;
+
+    for (off = 0; off < size; off += (off_t)len)
+    {
+        len = ((uintmax_t)(size - off) < window) ? (size_t)(size - off) : window;
+
+        p = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, off);
+        if (p == MAP_FAILED)
+            return (off == 0) ? 1 : -1;
+
+        (void)madvise(p, len, MADV_SEQUENTIAL);
+        (void)madvise(p, len, MADV_WILLNEED);
+        fnvupdate(s, len, p);
+        (void)munmap(p, len);
+    }
+
+    return 0;
+}
+
+static int hashread(int fd, unsigned char *buf, Fnv *s)
+{
+    ssize_t n;
+
+    for (;;)
+    {
+        n = read(fd, buf, bufsize);
+        if (n == 0)
+            return 0;
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        fnvupdate(s, (size_t)n, buf);
+    }
+}
+
+static int sumfile(char const *path, unsigned char *buf)
+{
+    int fd, rc = 1;
+    struct stat st;
+    Fnv s;
+
+    fd = (strcmp(path, "-") == 0) ? STDIN_FILENO : open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+
+    if (fstat(fd, &st) == -1)
+        goto closefd;
+
+    fnvinit(&s);
+
+    /* map regular files, falling back to reads if the first map fails */
+    if (jobs > 0)
+    {
+        if (S_ISREG(st.st_mode) && st.st_size > 0 && (uintmax_t)st.st_size <= (size_t)-1)
+            rc = treemapped(fd, (size_t)st.st_size, &s);
+
+        if (rc == 1)
+            rc = treeread(fd, buf, &s);
+    }
+    else
+    {
+        if (S_ISREG(st.st_mode) && st.st_size > 0)
+            rc = hashmapped(fd, st.st_size, &s);
+
+        if (rc == 1)
+            rc = hashread(fd, buf, &s);
+    }
+
+    if (rc == 0)
+        printf("%016" PRIx64 "  %s\n", fnvfinal(&s), path);
+
+closefd:
+    if (fd != STDIN_FILENO)
+        (void)close(fd);
+    return (rc == 0) ? 0 : -1;
+}
+
+/* Parse a byte count with an optional k, m or g suffix; 0 when malformed,
+ * negative or too large. */
+static size_t parsesize(char const *s)
+{
+    char *end;
+    unsigned long n;
+    int shifts = 0;
+
+    /* strtoul would skip blanks and negate a leading minus */
+    if (*s < '0' || *s > '9')
+        return 0;
+
+    errno = 0;
+    n = strtoul(s, &end, 10);
+    if (errno != 0 || end == s)
+        return 0;
+
+    switch (*end)
+    {
+    case 'g':
+    case 'G':
+        shifts += 1;
+        /* fallthrough */
+    case 'm':
+    case 'M':
+        shifts += 1;
+        /* fallthrough */
+    case 'k':
+    case 'K':
+        shifts += 1;
+        ++end;
+        break;
+    }
+
+    for (; shifts > 0; --shifts)
+    {
+        if (n > ULONG_MAX >> 10)
+            return 0;
+        n <<= 10;
+    }
+
+    return (*end == '\0') ? (size_t)n : 0;
+}
+
+static void usage(void)
+{
+    eprintf("usage: fnvsum [-j jobs] [-b chunksize] [file...]\n"
+            "  -j  tree hash with this many workers, 0 for one per cpu\n"
+            "  -b  tree chunk size, with optional k/m/g suffix (default 1m)\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    int i, opt, ret = EXIT_SUCCESS;
+    unsigned char *buf;
+    char *end;
+    double start, elapsed;
+
+    while ((opt = getopt(argc, argv, "j:b:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'j':
+            jobs = strtol(optarg, &end, 10);
+            if (*end != '\0' || jobs < 0)
+                usage();
+            if (jobs == 0)
+                jobs = sysconf(_SC_NPROCESSORS_ONLN);
+            if (jobs < 1)
+                jobs = 1;
+            break;
+        case 'b':
+            chunk = parsesize(optarg);
+            if (chunk == 0)
+                usage();
+            break;
+        default:
+            usage();
+        }
+    }
+
+    /* a chunk size alone asks for a tree hash */
+    if (chunk != 0 && jobs == 0)
+        jobs = 1;
+    if (chunk == 0)
+        chunk = defaultchunk;
+
+    buf = malloc((jobs > 0 && chunk > bufsize) ? chunk : bufsize);
+    if (buf == NULL)
+    {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    start = now();
+
+    if (optind == argc && sumfile("-", buf) != 0)
+    {
+        perror("-");
+        ret = EXIT_FAILURE;
+    }
+
+    for (i = optind; i < argc; ++i)
+    {
+        if (sumfile(argv[i], buf) != 0)
+        {
+            perror(argv[i]);
+            ret = EXIT_FAILURE;
+        }
+    }
+
+    elapsed = now() - start;
+
+    if (jobs > 0)
+    {
+        eprintf("fnvsum: %.1f MiB in %.3f s, %.1f MiB/s, jobs: %ld, chunk: %lu bytes\n",
+                (double)total / (1 << 20), elapsed, (elapsed > 0) ? (double)total / (1 << 20) / elapsed : 0.0, jobs,
+                (unsigned long)chunk);
+    }
+
+    free(buf);
+    return ret;
+}
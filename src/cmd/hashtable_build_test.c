@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bits.h"
+#include "macro.h"
+#include "printf.h"
+
+static char const *const keys[] = {
+#define X(prefix) #prefix "_key",
+#include "hashtable_vectors.def"
+#undef X
+};
+
+static void *const values[] = {
+#define X(prefix) #prefix "_value",
+#include "hashtable_vectors.def"
+#undef X
+};
+
+static char const *const dupkeys[] = { "a", "b", "a", "c", "b" };
+
+static void *const dupvalues[] = { "1", "2", "3", "4", "5" };
+
+static size_t const nlarge = 100000;
+
+static int checkvectors(void)
+{
+    int ret = 0;
+    size_t i;
+    char *value;
+    Table *t;
+    Tablestats s;
+
+    t = tablebuild(NELEM(keys), keys, values, Bunique);
+    if (t == NULL)
+        return 0;
+
+    for (i = 0; i < NELEM(keys); ++i)
+    {
+        value = tableget(t, keys[i]);
+        if (value == NULL || strcmp(values[i], value) != 0)
+        {
+            eprintf("FAIL vectors: key '%s'\n", keys[i]);
+            goto destroyt;
+        }
+    }
+
+    if (tablestats(t, &s) != 0 || s.live != NELEM(keys))
+        goto destroyt;
+
+    /* a built table must stay mutable */
+    if (tabledel(t, keys[0], NULL) != 0 || tableget(t, keys[0]) != NULL)
+        goto destroyt;
+
+    if (tableput(t, "new_key", "new_value") != 0 || tableput(t, keys[0], values[0]) != 0)
+        goto destroyt;
+
+    tablecompact(t);
+
+    if (tableget(t, "new_key") == NULL || tableget(t, keys[0]) != values[0])
+        goto destroyt;
+
+    ret = 1;
+destroyt:
+    tabledestroy(t, NULL);
+    return ret;
+}
+
+static int checkduplicates(void)
+{
+    int ret = 0;
+    Table *t;
+    Tablestats s;
+
+    t = tablebuild(NELEM(dupkeys), dupkeys, dupvalues, 0);
+    if (t == NULL)
+        return 0;
+
+    if (tablestats(t, &s) != 0 || s.live != 3)
+    {
+        eprintf("FAIL duplicates: expected 3 live entries\n");
+        goto destroyt;
+    }
+
+    /* the last value for a key wins, as with repeated tableput */
+    if (tableget(t, "a") != dupvalues[2] || tableget(t, "b") != dupvalues[4] || tableget(t, "c") != dupvalues[3])
+    {
+        eprintf("FAIL duplicates: wrong value\n");
+        goto destroyt;
+    }
+
+    ret = 1;
+destroyt:
+    tabledestroy(t, NULL);
+    return ret;
+}
+
+static int checklarge(void)
+{
+    int ret = 0;
+    size_t i;
+    char **k;
+    char *buf;
+    Table *t = NULL;
+
+    k = calloc(nlarge, sizeof(*k));
+    buf = calloc(nlarge, 16);
+    if (k == NULL || buf == NULL)
+        goto freeall;
+
+    for (i = 0; i < nlarge; ++i)
+    {
+        k[i] = buf + (i * 16);
+        (void)sprintf(k[i], "key%lu", (unsigned long)i);
+    }
+
+    t = tablebuild(nlarge, (char const *const *)k, (void *const *)k, Bunique | Bparallel);
+    if (t == NULL)
+        goto freeall;
+
+    for (i = 0; i < nlarge; ++i)
+    {
+        if (tableget(t, k[i]) != k[i])
+        {
+            eprintf("FAIL large: key '%s'\n", k[i]);
+            goto freeall;
+        }
+    }
+
+    ret = 1;
+freeall:
+    tabledestroy(t, NULL);
+    free(buf);
+    free(k);
+    return ret;
+}
+
+int main(void)
+{
+    if (tablebuild(0, keys, values, 0) != NULL)
+        return EXIT_FAILURE;
+
+    if (!checkvectors() || !checkduplicates() || !checklarge())
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
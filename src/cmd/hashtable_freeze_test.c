@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bits.h"
+#include "macro.h"
+#include "printf.h"
+
+static char const *const keys[] = {
+#define X(prefix) #prefix "_key",
+#include "hashtable_vectors.def"
+#undef X
+};
+
+static void *const values[] = {
+#define X(prefix) #prefix "_value",
+#include "hashtable_vectors.def"
+#undef X
+};
+
+/* test hook in hashtable.c, not part of bits.h */
+Frozen *tablefreezelevels(Table *t, size_t maxlevels);
+
+static size_t const nlarge = 200000;
+
+/* keys frozen with few levels, so that a good share of them spill */
+static size_t const nspill = 5000;
+
+static int checkvectors(void)
+{
+    int ret = 0;
+    size_t i;
+    Table *t;
+    Frozen *f = NULL;
+
+    t = tablecreate(8);
+    if (t == NULL)
+        return 0;
+
+    for (i = 0; i < NELEM(keys); ++i)
+        (void)tableput(t, keys[i], values[i]);
+
+    /* tombstones must not be frozen */
+    (void)tabledel(t, keys[0], NULL);
+
+    f = tablefreeze(t);
+    if (f == NULL)
+        goto destroy;
+
+    if (frozenget(f, keys[0]) != NULL || frozenget(f, "not_in_table") != NULL)
+    {
+        eprintf("FAIL vectors: found a missing key\n");
+        goto destroy;
+    }
+
+    for (i = 1; i < NELEM(keys); ++i)
+    {
+        if (frozenget(f, keys[i]) != values[i])
+        {
+            eprintf("FAIL vectors: key '%s'\n", keys[i]);
+            goto destroy;
+        }
+    }
+
+    ret = 1;
+destroy:
+    frozendestroy(f);
+    tabledestroy(t, NULL);
+    return ret;
+}
+
+static int checklarge(void)
+{
+    int ret = 0;
+    size_t i;
+    char **k;
+    char *buf, miss[32];
+    Table *t = NULL;
+    Frozen *f = NULL;
+
+    k = calloc(nlarge, sizeof(*k));
+    buf = calloc(nlarge, 16);
+    if (k == NULL || buf == NULL)
+        goto destroy;
+
+    for (i = 0; i < nlarge; ++i)
+    {
+        k[i] = buf + (i * 16);
+        (void)sprintf(k[i], "key%lu", (unsigned long)i);
+    }
+
+    t = tablebuild(nlarge, (char const *const *)k, (void *const *)k, Bunique);
+    if (t == NULL)
+        goto destroy;
+
+    f = tablefreeze(t);
+    if (f == NULL)
+        goto destroy;
+
+    for (i = 0; i < nlarge; ++i)
+    {
+        if (frozenget(f, k[i]) != k[i])
+        {
+            eprintf("FAIL large: key '%s'\n", k[i]);
+            goto destroy;
+        }
+
+        (void)sprintf(miss, "miss%lu", (unsigned long)i);
+        if (frozenget(f, miss) != NULL)
+        {
+            eprintf("FAIL large: found '%s'\n", miss);
+            goto destroy;
+        }
+    }
+
+    ret = 1;
+destroy:
+    frozendestroy(f);
+    tabledestroy(t, NULL);
+    free(buf);
+    free(k);
+    return ret;
+}
+
+/* Every key is found whether it got a slot at some level or spilled, and no
+ * absent key is found, down to no levels at all. */
+static int checkspill(void)
+{
+    int ret = 0;
+    size_t i, levels;
+    char **k;
+    char *buf, miss[32];
+    Table *t = NULL;
+    Frozen *f = NULL;
+
+    k = calloc(nspill, sizeof(*k));
+    buf = calloc(nspill, 16);
+    if (k == NULL || buf == NULL)
+        goto destroy;
+
+    for (i = 0; i < nspill; ++i)
+    {
+        k[i] = buf + (i * 16);
+        (void)sprintf(k[i], "spill%lu", (unsigned long)i);
+    }
+
+    t = tablebuild(nspill, (char const *const *)k, (void *const *)k, Bunique);
+    if (t == NULL)
+        goto destroy;
+
+    for (levels = 0; levels <= 3; ++levels)
+    {
+        f = tablefreezelevels(t, levels);
+        if (f == NULL)
+            goto destroy;
+
+        for (i = 0; i < nspill; ++i)
+        {
+            if (frozenget(f, k[i]) != k[i])
+            {
+                eprintf("FAIL spill: key '%s' with %lu levels\n", k[i], (unsigned long)levels);
+                goto destroy;
+            }
+
+            (void)sprintf(miss, "miss%lu", (unsigned long)i);
+            if (frozenget(f, miss) != NULL)
+            {
+                eprintf("FAIL spill: found '%s' with %lu levels\n", miss, (unsigned long)levels);
+                goto destroy;
+            }
+        }
+
+        frozendestroy(f);
+        f = NULL;
+    }
+
+    ret = 1;
+destroy:
+    frozendestroy(f);
+    tabledestroy(t, NULL);
+    free(buf);
+    free(k);
+    return ret;
+}
+
+int main(void)
+{
+    Table *t;
+    Frozen *f;
+
+    /* an empty table freezes to an empty frozen table */
+    t = tablecreate(8);
+    f = tablefreeze(t);
+    if (f == NULL || frozenget(f, "a") != NULL)
+        return EXIT_FAILURE;
+    frozendestroy(f);
+    tabledestroy(t, NULL);
+
+    if (!checkvectors() || !checklarge() || !checkspill())
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
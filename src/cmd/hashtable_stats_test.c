@@ -0,0 +1,111 @@
+#include <stdlib.h>
+
+#include "bits.h"
+#include "macro.h"
+#include "printf.h"
+
+static struct
+{
+    char const *key;
+    char *value;
+} const vectors[] = {
+#define X(prefix) { #prefix "_key", #prefix "_value" },
+#include "hashtable_vectors.def"
+#undef X
+    { NULL, NULL },
+};
+
+static size_t const ndeleted = 4;
+
+static int check(Tablestats const *s, size_t live, size_t deleted)
+{
+    size_t i, n;
+
+    if (s->live != live || s->deleted != deleted)
+    {
+        eprintf("live: %lu (expected %lu), deleted: %lu (expected %lu)\n",
+                (unsigned long)s->live, (unsigned long)live, (unsigned long)s->deleted, (unsigned long)deleted);
+        return 0;
+    }
+
+    for (i = 0, n = 0; i < NELEM(s->chains); ++i)
+        n += s->chains[i];
+
+    if (n != s->columns)
+    {
+        eprintf("chain histogram covers %lu of %lu columns\n", (unsigned long)n, (unsigned long)s->columns);
+        return 0;
+    }
+
+    if (s->nodes > live + deleted || s->maxchain > live + deleted)
+    {
+        eprintf("nodes: %lu, maxchain: %lu\n", (unsigned long)s->nodes, (unsigned long)s->maxchain);
+        return 0;
+    }
+
+    if (s->nodebytes == 0 && s->nodes != 0)
+        return 0;
+
+    if (live > 0 && s->keybytes == 0)
+        return 0;
+
+    return 1;
+}
+
+int main(void)
+{
+    int ret = EXIT_FAILURE;
+    char const *key = NULL;
+    Tablestats s, before;
+    Table *t;
+    size_t i, n;
+
+    t = tablecreate(8);
+    if (t == NULL)
+        return EXIT_FAILURE;
+
+    for (n = 0; (key = vectors[n].key) != NULL; ++n)
+        tableput(t, key, vectors[n].value);
+
+    if (tablestats(t, &s) != 0 || !check(&s, n, 0))
+        goto destroyt;
+
+    for (i = 0; i < ndeleted; ++i)
+        tabledel(t, vectors[i].key, NULL);
+
+    if (tablestats(t, &s) != 0 || !check(&s, n - ndeleted, ndeleted))
+        goto destroyt;
+
+    for (i = 0; i < n; ++i)
+        (void)tableget(t, vectors[i].key);
+
+    if (tablestats(t, &s) != 0)
+        goto destroyt;
+
+#ifdef BITS_STATS
+    if (s.lookups != n || s.misses != ndeleted || s.probes < n)
+    {
+        eprintf("lookups: %lu, misses: %lu, probes: %lu\n", (unsigned long)s.lookups, (unsigned long)s.misses, (unsigned long)s.probes);
+        goto destroyt;
+    }
+#endif
+
+    before = s;
+    tablecompact(t);
+
+    /* the deleted keys sit in the columns' embedded entries, each with live
+     * nodes chained behind it: every tombstone is refilled from its chain */
+    if (tablestats(t, &s) != 0 || !check(&s, n - ndeleted, 0))
+        goto destroyt;
+
+    if (s.nodes != before.nodes - ndeleted)
+    {
+        eprintf("compact: nodes %lu -> %lu\n", (unsigned long)before.nodes, (unsigned long)s.nodes);
+        goto destroyt;
+    }
+
+    ret = EXIT_SUCCESS;
+destroyt:
+    tabledestroy(t, NULL);
+    return ret;
+}
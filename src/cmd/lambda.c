@@ -1,12 +1,32 @@
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
 #include <limits.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "bits.h"
+#include "macro.h"
 #include "printf.h"
 
+/* arenas: the AST lives in the first, show's and parse's stacks in the
+ * second, the evaluator's terms and closures in the third */
+enum
+{
+    Aast = 0,
+    Astack = 1,
+    Aeval = 2
+};
+
+/* bench input size in MiB unless given, the most it takes, and the time to
+ * keep parsing it */
+static long const benchmib = 8;
+static long const maxbenchmib = 4096;
+static double const benchseconds = 1.0;
+
 struct Expr
 {
     union
@@ -37,44 +57,45 @@ struct Expr
     } tag;
 };
 
-static struct Expr *varcreate(char const *name)
+/* A variable or lambda with its name copied right after the node, so each
+ * takes one arena allocation. */
+static struct Expr *named(int tag, char const *name, size_t len)
 {
     struct Expr *e;
-    size_t len;
+    char *copy;
 
-    e = aalloc(sizeof(*e), 0);
+    assert(len <= INT_MAX - sizeof(*e) - 1);
+    e = aalloc((int)(sizeof(*e) + len + 1), Aast);
     if (e == NULL)
         return NULL;
 
-    len = strlen(name) + 1;
-    e->u.var.name = aalloc((assert(len <= INT_MAX), (int)len), 0);
-    if (e->u.var.name == NULL)
-        return NULL;
+    copy = (char *)(e + 1);
+    memcpy(copy, name, len);
+    copy[len] = '\0';
 
-    memcpy(e->u.var.name, name, len);
-    e->tag = Tvar;
+    if (tag == Tvar)
+        e->u.var.name = copy;
+    else
+        e->u.lam.param = copy;
+    e->tag = tag;
 
     return e;
 }
 
+static struct Expr *varcreate(char const *name)
+{
+    return named(Tvar, name, strlen(name));
+}
+
 static struct Expr *lamcreate(char const *param, struct Expr *body)
 {
     struct Expr *e;
-    size_t len;
 
-    e = aalloc(sizeof(*e), 0);
+    e = named(Tlam, param, strlen(param));
     if (e == NULL)
         return NULL;
 
-    len = strlen(param) + 1;
-    e->u.lam.param = aalloc((assert(len <= INT_MAX), (int)len), 0);
-    if (e->u.lam.param == NULL)
-        return NULL;
-
-    memcpy(e->u.lam.param, param, len);
     e->u.lam.body = body;
-    e->tag = Tlam;
-
     return e;
 }
 
@@ -82,7 +103,7 @@ static struct Expr *appcreate(struct Expr *fun, struct Expr *arg)
 {
     struct Expr *e;
 
-    e = aalloc(sizeof(*e), 0);
+    e = aalloc(sizeof(*e), Aast);
     if (e == NULL)
         return NULL;
 
@@ -110,7 +131,7 @@ static int push(struct Stackitem **stack, int action, struct Expr *expr)
 {
     struct Stackitem *item;
 
-    item = aalloc(sizeof(*item), 1);
+    item = aalloc(sizeof(*item), Astack);
     if (item == NULL)
     {
         eprintf("allocation failed");
@@ -194,15 +215,1402 @@ static void show(struct Expr *e, FILE *out)
     }
 
     (void)fprintf(out, "\n");
-    areset(1);
+    areset(Astack);
+}
+
+/* An open parenthesis, or a lambda whose body runs to the enclosing one */
+struct Frame
+{
+    enum
+    {
+        Froot,
+        Fparen,
+        Flam
+    } kind;
+    struct Expr *acc; /**< Application of the terms so far, NULL before the first */
+    struct Expr *lam; /**< Flam: the lambda, its body still unset */
+    struct Frame *next;
+};
+
+/* popped frames, reused before the arena is asked for more */
+static struct Frame *framefree;
+
+static char const *parseerror;
+
+static int pushframe(struct Frame **stack, int kind, struct Expr *lam)
+{
+    struct Frame *f;
+
+    f = framefree;
+    if (f != NULL)
+        framefree = f->next;
+    else
+    {
+        f = aalloc(sizeof(*f), Astack);
+        if (f == NULL)
+            return -1;
+    }
+
+    f->kind = kind;
+    f->acc = NULL;
+    f->lam = lam;
+    f->next = *stack;
+    *stack = f;
+    return 0;
+}
+
+/* Juxtaposition applies left to right: f a b is ((f a) b). */
+static int addterm(struct Frame *f, struct Expr *e)
+{
+    if (f->acc != NULL)
+    {
+        e = appcreate(f->acc, e);
+        if (e == NULL)
+            return -1;
+    }
+
+    f->acc = e;
+    return 0;
+}
+
+/* Close the top frame and hand its term, wrapped in its lambda if any, to
+ * the frame below. */
+static int popframe(struct Frame **stack)
+{
+    struct Frame *f = *stack;
+    struct Expr *e = f->acc;
+
+    if (e == NULL)
+    {
+        parseerror = (f->kind == Flam) ? "lambda without a body" : "empty parentheses";
+        return -1;
+    }
+
+    if (f->lam != NULL)
+    {
+        f->lam->u.lam.body = e;
+        e = f->lam;
+    }
+
+    *stack = f->next;
+    f->next = framefree;
+    framefree = f;
+    return addterm(*stack, e);
+}
+
+/* character classes, filled in by the first parse: a table lookup per
+ * byte instead of the locale-aware ctype calls */
+enum
+{
+    Cspace = 1,
+    Cname = 2
+};
+
+static unsigned char classes[UCHAR_MAX + 1];
+
+static void initclasses(void)
+{
+    int c;
+
+    if (classes['x'] != 0)
+        return;
+
+    for (c = 0; c <= UCHAR_MAX; ++c)
+    {
+        if (c < 128 && isspace(c))
+            classes[c] = Cspace;
+        else if (c < 128 && (isalnum(c) || c == '_' || c == '\''))
+            classes[c] = Cname;
+    }
 }
 
-int main(void)
+static int isnamechar(int c)
+{
+    return classes[(unsigned char)c] == Cname;
+}
+
+static size_t skipspace(char const *text, size_t len, size_t i)
+{
+    while (i < len && classes[(unsigned char)text[i]] == Cspace)
+        i += 1;
+    return i;
+}
+
+static size_t skipname(char const *text, size_t len, size_t i)
+{
+    while (i < len && classes[(unsigned char)text[i]] == Cname)
+        i += 1;
+    return i;
+}
+
+/* Parse the syntax show prints, also accepting any whitespace, bare
+ * juxtaposition and \x y . body for nested lambdas; a lambda's body runs to
+ * the enclosing parenthesis.  Iterative, with explicit frames, so nesting
+ * depth is bounded only by memory.  Returns NULL with parseerror set and
+ * *at the offset of the error. */
+static struct Expr *parse(char const *text, size_t len, size_t *at)
+{
+    struct Frame *stack = NULL;
+    struct Expr *e = NULL;
+    size_t i = 0, j;
+
+    initclasses();
+    framefree = NULL;
+    parseerror = "out of memory";
+    if (pushframe(&stack, Froot, NULL) != 0)
+        goto resetstack;
+
+    for (;;)
+    {
+        i = skipspace(text, len, i);
+        if (i == len)
+            break;
+
+        switch (text[i])
+        {
+        case '(':
+            if (pushframe(&stack, Fparen, NULL) != 0)
+                goto resetstack;
+            i += 1;
+            break;
+        case '\\':
+            i = skipspace(text, len, i + 1);
+            if (i == len || !isnamechar(text[i]))
+            {
+                parseerror = "lambda without a parameter";
+                goto resetstack;
+            }
+
+            while (i < len && isnamechar(text[i]))
+            {
+                j = skipname(text, len, i);
+                e = named(Tlam, text + i, j - i);
+                if (e == NULL || pushframe(&stack, Flam, e) != 0)
+                    goto resetstack;
+                i = skipspace(text, len, j);
+            }
+
+            if (i == len || text[i] != '.')
+            {
+                parseerror = "expected . after lambda parameters";
+                goto resetstack;
+            }
+            i += 1;
+            break;
+        case ')':
+            while (stack->kind == Flam)
+            {
+                if (popframe(&stack) != 0)
+                    goto resetstack;
+            }
+            if (stack->kind != Fparen)
+            {
+                parseerror = "unbalanced )";
+                goto resetstack;
+            }
+            if (popframe(&stack) != 0)
+                goto resetstack;
+            i += 1;
+            break;
+        default:
+            if (!isnamechar(text[i]))
+            {
+                parseerror = "unexpected character";
+                goto resetstack;
+            }
+
+            j = skipname(text, len, i);
+            e = named(Tvar, text + i, j - i);
+            if (e == NULL || addterm(stack, e) != 0)
+                goto resetstack;
+            i = j;
+        }
+    }
+
+    while (stack->kind == Flam)
+    {
+        if (popframe(&stack) != 0)
+            goto resetstack;
+    }
+
+    e = stack->acc;
+    if (stack->kind != Froot)
+        parseerror = "missing )";
+    else if (e == NULL)
+        parseerror = "empty input";
+    else
+    {
+        areset(Astack);
+        return e;
+    }
+
+resetstack:
+    *at = i;
+    areset(Astack);
+    return NULL;
+}
+
+/* Random closed-ish terms as text, in show's format.  A lambda at depth d
+ * binds xd, so no name is shadowed and a variable picks any depth below
+ * its own; at depth 0 the only variable is the free y. */
+struct Gen
+{
+    char *buf;
+    size_t len;
+    size_t cap;
+    uint64_t rng;
+};
+
+struct Genitem
+{
+    long nodes; /**< Budget of the hole, or -1 for a literal */
+    long depth;
+    char const *text;
+};
+
+static uint64_t nextrand(struct Gen *g)
+{
+    /* xorshift64* */
+    g->rng ^= g->rng >> 12;
+    g->rng ^= g->rng << 25;
+    g->rng ^= g->rng >> 27;
+    return g->rng * 0x2545f4914f6cdd1d;
+}
+
+static int emit(struct Gen *g, char const *s, size_t n)
+{
+    char *buf;
+    size_t cap;
+
+    if (g->len + n > g->cap)
+    {
+        cap = (g->cap > 0) ? g->cap : 4096;
+        while (cap < g->len + n)
+            cap *= 2;
+
+        buf = realloc(g->buf, cap);
+        if (buf == NULL)
+            return -1;
+        g->buf = buf;
+        g->cap = cap;
+    }
+
+    memcpy(g->buf + g->len, s, n);
+    g->len += n;
+    return 0;
+}
+
+static int emitname(struct Gen *g, long depth)
+{
+    char name[32];
+    int n;
+
+    if (depth < 0)
+        return emit(g, "y", 1);
+
+    n = snprintf(name, sizeof(name), "x%ld", depth);
+    return emit(g, name, (size_t)n);
+}
+
+/* Append a term of exactly nodes nodes to g->buf. */
+static int generate(struct Gen *g, long nodes)
+{
+    struct Genitem *stack, *grown, it;
+    size_t top = 0, cap = 64;
+    long a;
+    int rc = -1;
+
+    stack = malloc(cap * sizeof(*stack));
+    if (stack == NULL)
+        return -1;
+
+    stack[top].nodes = nodes;
+    stack[top].depth = 0;
+    stack[top++].text = NULL;
+
+    while (top > 0)
+    {
+        it = stack[--top];
+        if (it.nodes < 0)
+        {
+            if (emit(g, it.text, strlen(it.text)) != 0)
+                goto freestack;
+            continue;
+        }
+
+        /* room for the four items a hole can push */
+        if (top + 4 > cap)
+        {
+            cap *= 2;
+            grown = realloc(stack, cap * sizeof(*stack));
+            if (grown == NULL)
+                goto freestack;
+            stack = grown;
+        }
+
+        if (it.nodes == 1)
+        {
+            if (emitname(g, (it.depth > 0) ? (long)(nextrand(g) % (uint64_t)it.depth) : -1) != 0)
+                goto freestack;
+        }
+        else if (it.nodes == 2 || nextrand(g) % 3 == 0)
+        {
+            if (emit(g, "(\\", 2) != 0 || emitname(g, it.depth) != 0 || emit(g, " . ", 3) != 0)
+                goto freestack;
+
+            stack[top].nodes = -1;
+            stack[top++].text = ")";
+            stack[top].nodes = it.nodes - 1;
+            stack[top++].depth = it.depth + 1;
+        }
+        else
+        {
+            if (emit(g, "(", 1) != 0)
+                goto freestack;
+
+            a = 1 + (long)(nextrand(g) % (uint64_t)(it.nodes - 2));
+            stack[top].nodes = -1;
+            stack[top++].text = ")";
+            stack[top].nodes = it.nodes - 1 - a;
+            stack[top++].depth = it.depth;
+            stack[top].nodes = -1;
+            stack[top++].text = " ";
+            stack[top].nodes = a;
+            stack[top++].depth = it.depth;
+        }
+    }
+
+    rc = 0;
+freestack:
+    free(stack);
+    return rc;
+}
+
+/* Terms for evaluation, variables as de Bruijn indices: Dvar i refers to
+ * the lambda i binders out, counting from 0.  A free variable keeps its
+ * name, and Dlevel stands for the variable of a lambda being normalized
+ * under, numbered from the outermost binder. */
+struct Term
+{
+    union
+    {
+        long index;        /**< Dvar */
+        long level;        /**< Dlevel */
+        char const *name;  /**< Dfree */
+        struct Term *body; /**< Dlam */
+
+        struct
+        {
+            struct Term *fun;
+            struct Term *arg;
+        } app;
+    } u;
+
+    enum
+    {
+        Dvar,
+        Dfree,
+        Dlevel,
+        Dlam,
+        Dapp
+    } tag;
+};
+
+/* A closure.  Once a lambda binds it, it is also that lambda's link in the
+ * environment, next leading to the outer bindings.  Forcing it overwrites
+ * term and env with the value, so the work is shared by every use. */
+struct Cell
+{
+    struct Term *term;
+    struct Cell *env;
+    struct Cell *next;
+};
+
+/* An argument, or a cell to update when the term on top reaches a value */
+struct Slot
+{
+    struct Cell *cell;
+    int update;
+};
+
+struct Machine
+{
+    struct Slot *stack;
+    size_t top;
+    size_t cap;
+    unsigned long steps;
+    unsigned long betas;
+};
+
+/* p grown to room for need elements of size bytes, doubling *cap; NULL
+ * when out of memory, p still valid */
+static void *grow(void *p, size_t *cap, size_t need, size_t size)
+{
+    void *grown;
+    size_t n = (*cap > 0) ? *cap : 64;
+
+    if (need <= *cap)
+        return p;
+
+    while (n < need)
+        n *= 2;
+
+    grown = realloc(p, n * size);
+    if (grown != NULL)
+        *cap = n;
+    return grown;
+}
+
+static struct Term *termcreate(int tag)
+{
+    struct Term *t;
+
+    t = aalloc(sizeof(*t), Aeval);
+    if (t != NULL)
+        t->tag = tag;
+    return t;
+}
+
+static struct Cell *cellcreate(struct Term *term, struct Cell *env, struct Cell *next)
+{
+    struct Cell *c;
+
+    c = aalloc(sizeof(*c), Aeval);
+    if (c == NULL)
+        return NULL;
+
+    c->term = term;
+    c->env = env;
+    c->next = next;
+    return c;
+}
+
+struct Convitem
+{
+    struct Expr *expr; /**< NULL: leave the innermost scope */
+    struct Term **out;
+};
+
+/* k when name is x, k primes and a number, so that it could be taken for a
+ * binder toexpr names with k primes; -1 otherwise */
+static long binderprimes(char const *name)
+{
+    long k = 0;
+
+    if (*name++ != 'x')
+        return -1;
+    for (; *name == '\''; ++name)
+        k += 1;
+    if (*name == '\0')
+        return -1;
+    for (; *name != '\0'; ++name)
+    {
+        if (*name < '0' || *name > '9')
+            return -1;
+    }
+    return k;
+}
+
+/* e with its variables looked up in the enclosing lambdas, innermost first.
+ * *primes is set to a number of primes after x that no free variable's
+ * name could clash with, for toexpr. */
+static struct Term *debruijn(struct Expr *e, long *primes)
+{
+    struct Convitem *stack = NULL, it;
+    char const **scope = NULL;
+    size_t top = 0, cap = 0, depth = 0, scap = 0, i;
+    struct Term *t, *root = NULL;
+    void *grown;
+    long k;
+
+    *primes = 0;
+    stack = grow(NULL, &cap, 1, sizeof(*stack));
+    if (stack == NULL)
+        return NULL;
+
+    stack[top].expr = e;
+    stack[top++].out = &root;
+
+    while (top > 0)
+    {
+        it = stack[--top];
+        if (it.expr == NULL)
+        {
+            depth -= 1;
+            continue;
+        }
+
+        grown = grow(stack, &cap, top + 2, sizeof(*stack));
+        if (grown == NULL)
+            goto fail;
+        stack = grown;
+
+        switch (it.expr->tag)
+        {
+        case Tvar:
+            for (i = depth; i > 0 && strcmp(scope[i - 1], it.expr->u.var.name) != 0; --i)
+                ;
+            t = termcreate((i > 0) ? Dvar : Dfree);
+            if (t == NULL)
+                goto fail;
+            if (i > 0)
+                t->u.index = (long)(depth - i);
+            else
+            {
+                t->u.name = it.expr->u.var.name;
+                k = binderprimes(t->u.name);
+                if (k >= *primes)
+                    *primes = k + 1;
+            }
+            *it.out = t;
+            break;
+        case Tlam:
+            t = termcreate(Dlam);
+            grown = grow(scope, &scap, depth + 1, sizeof(*scope));
+            if (t == NULL || grown == NULL)
+                goto fail;
+            scope = grown;
+            *it.out = t;
+            scope[depth++] = it.expr->u.lam.param;
+            stack[top].expr = NULL;
+            stack[top++].out = NULL;
+            stack[top].expr = it.expr->u.lam.body;
+            stack[top++].out = &t->u.body;
+            break;
+        case Tapp:
+            t = termcreate(Dapp);
+            if (t == NULL)
+                goto fail;
+            *it.out = t;
+            stack[top].expr = it.expr->u.app.arg;
+            stack[top++].out = &t->u.app.arg;
+            stack[top].expr = it.expr->u.app.fun;
+            stack[top++].out = &t->u.app.fun;
+            break;
+        }
+    }
+
+    free(scope);
+    free(stack);
+    return root;
+
+fail:
+    free(scope);
+    free(stack);
+    return NULL;
+}
+
+static int pushslot(struct Machine *m, struct Cell *c, int update)
+{
+    void *grown;
+
+    grown = grow(m->stack, &m->cap, m->top + 1, sizeof(*m->stack));
+    if (grown == NULL)
+        return -1;
+
+    m->stack = grown;
+
+    m->stack[m->top].cell = c;
+    m->stack[m->top++].update = update;
+    return 0;
+}
+
+/* Run the lazy Krivine machine (Sestoft, "Deriving a lazy abstract
+ * machine") on *t in *env to weak head normal form, the slots above base
+ * being its arguments.  Applications push their argument as a closure,
+ * lambdas pop one into the environment, variables enter their closure
+ * behind an update mark.  On return *t is a lambda with no argument left,
+ * or a Dfree or Dlevel head with its arguments, updates dropped, above
+ * base: first argument on top. */
+static int whnf(struct Machine *m, struct Term **t, struct Cell **env, size_t base)
+{
+    struct Term *term = *t;
+    struct Cell *e = *env, *c;
+    struct Slot *s;
+    size_t i, j;
+    long k;
+
+    for (;;)
+    {
+        m->steps += 1;
+        switch (term->tag)
+        {
+        case Dapp:
+            c = cellcreate(term->u.app.arg, e, NULL);
+            if (c == NULL || pushslot(m, c, 0) != 0)
+                return -1;
+            term = term->u.app.fun;
+            break;
+        case Dlam:
+            if (m->top == base)
+                goto done;
+
+            s = &m->stack[--m->top];
+            if (s->update)
+            {
+                s->cell->term = term;
+                s->cell->env = e;
+                break;
+            }
+
+            s->cell->next = e;
+            e = s->cell;
+            term = term->u.body;
+            m->betas += 1;
+            break;
+        case Dvar:
+            for (c = e, k = term->u.index; k > 0; --k)
+                c = c->next;
+
+            /* values need no update */
+            if ((c->term->tag == Dapp || c->term->tag == Dvar) && pushslot(m, c, 1) != 0)
+                return -1;
+
+            term = c->term;
+            e = c->env;
+            break;
+        case Dfree:
+        case Dlevel:
+            for (i = j = base; i < m->top; ++i)
+            {
+                if (!m->stack[i].update)
+                    m->stack[j++] = m->stack[i];
+            }
+            m->top = j;
+            goto done;
+        }
+    }
+
+done:
+    *t = term;
+    *env = e;
+    return 0;
+}
+
+struct Readitem
+{
+    struct Term *term;
+    struct Cell *env;
+    long depth; /**< Lambdas around the result */
+    struct Term **out;
+};
+
+/* The normal form of t in env as a new term: the weak head normal form of
+ * the whole, then in the same way the body of each lambda, its variable a
+ * fresh Dlevel, and each argument of a stuck head.  With full 0 only the
+ * whole is reduced and the rest read back as it stands, env substituted
+ * in. */
+static struct Term *normalize(struct Machine *m, struct Term *t, struct Cell *env, int full)
+{
+    struct Readitem *stack = NULL, it;
+    size_t top = 0, cap = 0, base, i;
+    struct Term *root = NULL, *head, *app;
+    struct Cell *c;
+    int reduce = 1;
+    long k;
+    void *grown;
+
+    stack = grow(NULL, &cap, 1, sizeof(*stack));
+    if (stack == NULL)
+        return NULL;
+
+    stack[top].term = t;
+    stack[top].env = env;
+    stack[top].depth = 0;
+    stack[top++].out = &root;
+
+    while (top > 0)
+    {
+        it = stack[--top];
+        base = m->top;
+        if (reduce && whnf(m, &it.term, &it.env, base) != 0)
+            goto fail;
+
+        grown = grow(stack, &cap, top + 2 + (m->top - base), sizeof(*stack));
+        if (grown == NULL)
+            goto fail;
+        stack = grown;
+
+        switch (it.term->tag)
+        {
+        case Dlam:
+            *it.out = termcreate(Dlam);
+            head = termcreate(Dlevel);
+            if (*it.out == NULL || head == NULL)
+                goto fail;
+            head->u.level = it.depth;
+            c = cellcreate(head, NULL, it.env);
+            if (c == NULL)
+                goto fail;
+
+            stack[top].term = it.term->u.body;
+            stack[top].env = c;
+            stack[top].depth = it.depth + 1;
+            stack[top++].out = &(*it.out)->u.body;
+            break;
+        case Dapp:
+            *it.out = termcreate(Dapp);
+            if (*it.out == NULL)
+                goto fail;
+
+            stack[top].term = it.term->u.app.arg;
+            stack[top].env = it.env;
+            stack[top].depth = it.depth;
+            stack[top++].out = &(*it.out)->u.app.arg;
+            stack[top].term = it.term->u.app.fun;
+            stack[top].env = it.env;
+            stack[top].depth = it.depth;
+            stack[top++].out = &(*it.out)->u.app.fun;
+            break;
+        case Dvar:
+            for (c = it.env, k = it.term->u.index; k > 0; --k)
+                c = c->next;
+
+            stack[top].term = c->term;
+            stack[top].env = c->env;
+            stack[top].depth = it.depth;
+            stack[top++].out = it.out;
+            break;
+        case Dfree:
+        case Dlevel:
+            head = it.term;
+            if (head->tag == Dlevel)
+            {
+                head = termcreate(Dvar);
+                if (head == NULL)
+                    goto fail;
+                head->u.index = it.depth - it.term->u.level - 1;
+            }
+
+            for (i = m->top; i > base; --i)
+            {
+                app = termcreate(Dapp);
+                if (app == NULL)
+                    goto fail;
+                app->u.app.fun = head;
+                head = app;
+
+                c = m->stack[i - 1].cell;
+                stack[top].term = c->term;
+                stack[top].env = c->env;
+                stack[top].depth = it.depth;
+                stack[top++].out = &app->u.app.arg;
+            }
+            m->top = base;
+            *it.out = head;
+            break;
+        }
+
+        reduce = full;
+    }
+
+    free(stack);
+    return root;
+
+fail:
+    free(stack);
+    return NULL;
+}
+
+struct Nameitem
+{
+    struct Term *term;
+    long depth;
+    struct Expr **out;
+};
+
+/* t with names for show: as in the generator, the lambda at depth d binds
+ * xd, with primes after the x so as not to capture a free variable */
+static struct Expr *toexpr(struct Term *t, long primes)
+{
+    struct Nameitem *stack = NULL, it;
+    size_t top = 0, cap = 0, n = (size_t)primes + 1;
+    struct Expr *e, *root = NULL;
+    char *name;
+    void *grown;
+
+    name = malloc(n + 32);
+    stack = grow(NULL, &cap, 1, sizeof(*stack));
+    if (name == NULL || stack == NULL)
+        goto fail;
+
+    name[0] = 'x';
+    memset(name + 1, '\'', n - 1);
+
+    stack[top].term = t;
+    stack[top].depth = 0;
+    stack[top++].out = &root;
+
+    while (top > 0)
+    {
+        it = stack[--top];
+        grown = grow(stack, &cap, top + 2, sizeof(*stack));
+        if (grown == NULL)
+            goto fail;
+        stack = grown;
+
+        switch (it.term->tag)
+        {
+        case Dvar:
+            (void)snprintf(name + n, 32, "%ld", it.depth - it.term->u.index - 1);
+            e = varcreate(name);
+            break;
+        case Dfree:
+            e = varcreate(it.term->u.name);
+            break;
+        case Dlam:
+            (void)snprintf(name + n, 32, "%ld", it.depth);
+            e = lamcreate(name, NULL);
+            if (e == NULL)
+                goto fail;
+            stack[top].term = it.term->u.body;
+            stack[top].depth = it.depth + 1;
+            stack[top++].out = &e->u.lam.body;
+            break;
+        case Dapp:
+            e = appcreate(NULL, NULL);
+            if (e == NULL)
+                goto fail;
+            stack[top].term = it.term->u.app.arg;
+            stack[top].depth = it.depth;
+            stack[top++].out = &e->u.app.arg;
+            stack[top].term = it.term->u.app.fun;
+            stack[top].depth = it.depth;
+            stack[top++].out = &e->u.app.fun;
+            break;
+        default:
+            /* normalize leaves no Dlevel behind */
+            assert(0);
+            e = NULL;
+        }
+
+        if (e == NULL)
+            goto fail;
+        *it.out = e;
+    }
+
+    free(stack);
+    free(name);
+    return root;
+
+fail:
+    free(stack);
+    free(name);
+    return NULL;
+}
+
+/* The normal form of e, or its weak head normal form when full is 0, in
+ * the AST arena; the evaluator's own arena is reset after. */
+static struct Expr *evaluate(struct Expr *e, int full, unsigned long *betas)
+{
+    struct Machine m = { NULL, 0, 0, 0, 0 };
+    struct Term *t;
+    struct Expr *nf = NULL;
+    long primes;
+
+    t = debruijn(e, &primes);
+    if (t != NULL)
+        t = normalize(&m, t, NULL, full);
+    if (t != NULL)
+        nf = toexpr(t, primes);
+
+    if (betas != NULL)
+        *betas = m.betas;
+    free(m.stack);
+    areset(Aeval);
+    return nf;
+}
+
+/* n when t is the Church numeral n, (\f . (\x . (f (f ... x)))), else -1 */
+static long church(struct Term *t)
+{
+    long n = 0;
+
+    if (t->tag != Dlam || t->u.body->tag != Dlam)
+        return -1;
+
+    for (t = t->u.body->u.body; t->tag == Dapp; t = t->u.app.arg)
+    {
+        if (t->u.app.fun->tag != Dvar || t->u.app.fun->u.index != 1)
+            return -1;
+        n += 1;
+    }
+
+    return (t->tag == Dvar && t->u.index == 0) ? n : -1;
+}
+
+/* Church numeral arithmetic, the usual evaluator workload */
+static char const churchadd[] = "(\\m n f x . m f (n f x))";
+static char const churchmul[] = "(\\m n f . m (n f))";
+static char const churchexp[] = "(\\m n . n m)";
+static char const churchsub[] = "(\\m n . n (\\n f x . n (\\g h . h (g f)) (\\u . x) (\\u . u)) m)";
+
+struct Churchcase
+{
+    char const *name;
+    char const *op;
+    long a;
+    long b;
+    long expect;
+};
+
+static int emitchurch(struct Gen *g, long n)
+{
+    long i;
+
+    if (emit(g, "(\\f x . ", 8) != 0)
+        return -1;
+    for (i = 0; i < n; ++i)
+    {
+        if (emit(g, "f (", 3) != 0)
+            return -1;
+    }
+    if (emit(g, "x", 1) != 0)
+        return -1;
+    for (i = 0; i < n; ++i)
+    {
+        if (emit(g, ")", 1) != 0)
+            return -1;
+    }
+    return emit(g, ")", 1);
+}
+
+/* (op a b) with the numerals written out, parsed into the AST arena */
+static struct Expr *churchterm(struct Gen *g, struct Churchcase const *c)
+{
+    size_t at;
+
+    g->len = 0;
+    if (emit(g, "(", 1) != 0 || emit(g, c->op, strlen(c->op)) != 0 || emit(g, " ", 1) != 0 ||
+        emitchurch(g, c->a) != 0 || emit(g, " ", 1) != 0 || emitchurch(g, c->b) != 0 || emit(g, ")", 1) != 0)
+        return NULL;
+
+    return parse(g->buf, g->len, &at);
+}
+
+/* The numeral e normalizes to, -1 when it is none or memory runs out;
+ * steps counts machine transitions, betas the ones that bind an argument */
+static long churchrun(struct Expr *e, unsigned long *steps, unsigned long *betas)
+{
+    struct Machine m = { NULL, 0, 0, 0, 0 };
+    struct Term *t;
+    long n = -1, primes;
+
+    t = debruijn(e, &primes);
+    if (t != NULL)
+        t = normalize(&m, t, NULL, 1);
+    if (t != NULL)
+        n = church(t);
+
+    *steps = m.steps;
+    *betas = m.betas;
+    free(m.stack);
+    areset(Aeval);
+    return n;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* show into a string; the caller frees it */
+static char *showstring(struct Expr *e, size_t *len)
+{
+    char *buf = NULL;
+    FILE *f;
+
+    f = open_memstream(&buf, len);
+    if (f == NULL)
+        return NULL;
+
+    show(e, f);
+    if (fclose(f) != 0)
+    {
+        free(buf);
+        return NULL;
+    }
+
+    return buf;
+}
+
+/* parse then show gives expect, followed by show's newline */
+static int roundtrip(char const *text, size_t len, char const *expect, size_t expectlen)
+{
+    struct Expr *e;
+    char *out;
+    size_t at, outlen;
+    int ok;
+
+    e = parse(text, len, &at);
+    if (e == NULL)
+    {
+        eprintf("parse: %s at offset %lu\n", parseerror, (unsigned long)at);
+        return 0;
+    }
+
+    out = showstring(e, &outlen);
+    ok = (out != NULL && outlen == expectlen + 1 && memcmp(out, expect, expectlen) == 0 && out[expectlen] == '\n');
+    if (!ok)
+        eprintf("parse: %.*s came back as %s", (int)(expectlen < 200 ? expectlen : 200), expect, out ? out : "nothing\n");
+
+    free(out);
+    areset(Aast);
+    return ok;
+}
+
+/* text evaluates to expect: its normal form, or weak head normal form
+ * when full is 0 */
+static int evalcheck(char const *text, int full, char const *expect)
+{
+    struct Expr *e;
+    char *out = NULL;
+    size_t at, outlen, expectlen = strlen(expect);
+    int ok;
+
+    e = parse(text, strlen(text), &at);
+    if (e != NULL)
+        e = evaluate(e, full, NULL);
+    if (e != NULL)
+        out = showstring(e, &outlen);
+
+    ok = (out != NULL && outlen == expectlen + 1 && memcmp(out, expect, expectlen) == 0);
+    if (!ok)
+        eprintf("eval: %s gave %s", text, out ? out : "nothing\n");
+
+    free(out);
+    areset(Aast);
+    return ok;
+}
+
+static int selftest(void)
+{
+    static char const *const same[] = { "x", "(\\x . x)", "(\\t . (\\f . t))", "((\\x . x) y)",
+                                        "((\\x' . (x' x')) (\\x_1 . (x_1 x_1)))" };
+    static char const *const lenient[][2] = {
+        { "  \\x y .\tx y z \n", "(\\x . (\\y . ((x y) z)))" },
+        { "(f a b (c d))", "(((f a) b) (c d))" },
+        { "(\\x.\\y.x)", "(\\x . (\\y . x))" },
+        { "f \\x . x", "(f (\\x . x))" },
+    };
+    static char const *const bad[] = { "", "  ", "(", ")", "()", "(x))", "((x)", "(\\x x)", "(\\ . x)", "(\\x .)",
+                                        "x @", "\\x" };
+    static struct
+    {
+        char const *text;
+        int full;
+        char const *expect;
+    } const evals[] = {
+        { "((\\x . x) y)", 1, "y" },
+        { "(\\x . ((\\y . y) x))", 1, "(\\x0 . x0)" },
+        { "(\\x . (\\x . x))", 1, "(\\x0 . (\\x1 . x1))" },
+        { "((\\x y . x) y)", 1, "(\\x0 . y)" },
+        { "((\\x y z . x z (y z)) (\\x y . x) (\\x y . x))", 1, "(\\x0 . x0)" },
+        { "(\\x . x ((\\y . y) x) ((\\y . y) z))", 1, "(\\x0 . ((x0 x0) z))" },
+        /* the argument that loops is never needed */
+        { "((\\x y . x) a ((\\x . x x) (\\x . x x)))", 1, "a" },
+        { "((\\x y . x) ((\\z . z) a))", 0, "(\\x0 . ((\\x1 . x1) a))" },
+        { "(f ((\\x . x) a))", 0, "(f ((\\x0 . x0) a))" },
+        /* binders are renamed around free variables that look like them */
+        { "(\\y . x0)", 1, "(\\x'0 . x0)" },
+        { "((\\x y . x) x0)", 1, "(\\x'0 . x0)" },
+        { "(\\y . x0 x'1 x12a)", 1, "(\\x''0 . ((x0 x'1) x12a))" },
+    };
+    static struct Churchcase const churches[] = {
+        { "add", churchadd, 2, 3, 5 }, { "mul", churchmul, 3, 4, 12 }, { "exp", churchexp, 2, 5, 32 },
+        { "exp", churchexp, 3, 1, 3 }, { "sub", churchsub, 7, 3, 4 }, { "sub", churchsub, 3, 7, 0 },
+    };
+    struct Gen g = { NULL, 0, 0, 0x9e3779b97f4a7c15 };
+    struct Expr *e;
+    unsigned long steps, betas;
+    size_t i, at;
+    long n;
+    int ok = 1;
+
+    for (i = 0; i < NELEM(same); ++i)
+        ok &= roundtrip(same[i], strlen(same[i]), same[i], strlen(same[i]));
+
+    for (i = 0; i < NELEM(lenient); ++i)
+        ok &= roundtrip(lenient[i][0], strlen(lenient[i][0]), lenient[i][1], strlen(lenient[i][1]));
+
+    for (i = 0; i < NELEM(bad); ++i)
+    {
+        if (parse(bad[i], strlen(bad[i]), &at) != NULL)
+        {
+            eprintf("parse: accepted \"%s\"\n", bad[i]);
+            ok = 0;
+        }
+    }
+
+    /* generated terms come back unchanged, deep ones included */
+    for (n = 1; n < 3000 && ok; n = n * 3 / 2 + 1)
+    {
+        g.len = 0;
+        if (generate(&g, n) != 0)
+            ok = 0;
+        else
+            ok &= roundtrip(g.buf, g.len, g.buf, g.len);
+    }
+
+    for (i = 0; i < NELEM(evals); ++i)
+        ok &= evalcheck(evals[i].text, evals[i].full, evals[i].expect);
+
+    for (i = 0; i < NELEM(churches); ++i)
+    {
+        e = churchterm(&g, &churches[i]);
+        n = (e != NULL) ? churchrun(e, &steps, &betas) : -1;
+        if (n != churches[i].expect)
+        {
+            eprintf("eval: %s %ld %ld gave %ld\n", churches[i].name, churches[i].a, churches[i].b, n);
+            ok = 0;
+        }
+        areset(Aast);
+    }
+
+    free(g.buf);
+    areset(Aast);
+    return ok;
+}
+
+/* what parsefile does with the term before showing it */
+enum
+{
+    Pshow,
+    Pwhnf,
+    Pnorm
+};
+
+static int parsefile(FILE *in, int mode)
+{
+    struct Expr *e;
+    char *text = NULL, *grown;
+    size_t len = 0, cap = 0, n, at;
+    int ret = EXIT_FAILURE;
+
+    do
+    {
+        if (len == cap)
+        {
+            cap = (cap > 0) ? 2 * cap : 65536;
+            grown = realloc(text, cap);
+            if (grown == NULL)
+                goto freetext;
+            text = grown;
+        }
+
+        n = fread(text + len, 1, cap - len, in);
+        len += n;
+    } while (n > 0);
+
+    if (ferror(in))
+    {
+        perror("read");
+        goto freetext;
+    }
+
+    e = parse(text, len, &at);
+    if (e == NULL)
+    {
+        eprintf("lambda: %s at offset %lu\n", parseerror, (unsigned long)at);
+        goto freetext;
+    }
+
+    if (mode != Pshow)
+    {
+        e = evaluate(e, mode == Pnorm, NULL);
+        if (e == NULL)
+        {
+            eprintf("lambda: out of memory\n");
+            goto freetext;
+        }
+    }
+
+    show(e, stdout);
+    ret = EXIT_SUCCESS;
+freetext:
+    free(text);
+    return ret;
+}
+
+static int gen(long nodes, uint64_t seed)
+{
+    struct Gen g = { NULL, 0, 0, 0 };
+    int ret = EXIT_FAILURE;
+
+    g.rng = seed * 0x9e3779b97f4a7c15 + 1;
+    if (generate(&g, nodes) != 0 || emit(&g, "\n", 1) != 0)
+    {
+        eprintf("lambda: out of memory\n");
+        goto freebuf;
+    }
+
+    if (fwrite(g.buf, 1, g.len, stdout) == g.len)
+        ret = EXIT_SUCCESS;
+freebuf:
+    free(g.buf);
+    return ret;
+}
+
+/* Parse a generated term of about mib MiB over and over for benchseconds. */
+static int bench(long mib)
+{
+    struct Gen g = { NULL, 0, 0, 0x2545f4914f6cdd1d };
+    long nodes, rounds = 0;
+    double start, elapsed;
+    size_t at;
+    int ret = EXIT_FAILURE;
+
+    /* a generated node takes about 4.5 bytes of text */
+    nodes = mib * 1024 * 1024 * 2 / 9;
+    if (generate(&g, nodes) != 0)
+    {
+        eprintf("lambda: out of memory\n");
+        goto freebuf;
+    }
+
+    start = now();
+    do
+    {
+        areset(Aast);
+        if (parse(g.buf, g.len, &at) == NULL)
+        {
+            eprintf("lambda: %s at offset %lu\n", parseerror, (unsigned long)at);
+            goto freebuf;
+        }
+        rounds += 1;
+        elapsed = now() - start;
+    } while (elapsed < benchseconds);
+
+    printf("parse: %.1f MiB, %ld nodes, %ld rounds in %.3f s: %.1f MiB/s, %.1f Mnodes/s\n",
+           (double)g.len / (1024 * 1024), nodes, rounds, elapsed, (double)g.len * (double)rounds / (1024 * 1024) / elapsed,
+           (double)nodes * (double)rounds / 1e6 / elapsed);
+    ret = EXIT_SUCCESS;
+freebuf:
+    free(g.buf);
+    afree(Aast);
+    return ret;
+}
+
+/* Normalize each Church workload over and over for benchseconds. */
+static int churchbench(void)
+{
+    static struct Churchcase const work[] = {
+        { "add", churchadd, 100000, 100000, 200000 },
+        { "mul", churchmul, 1000, 1000, 1000000 },
+        { "exp", churchexp, 2, 20, 1048576 },
+        { "sub", churchsub, 2000, 1000, 1000 },
+    };
+    struct Gen g = { NULL, 0, 0, 0 };
+    struct Expr *e;
+    unsigned long steps = 0, betas = 0;
+    long n, rounds;
+    double start, elapsed;
+    size_t i;
+    int ret = EXIT_FAILURE;
+
+    for (i = 0; i < NELEM(work); ++i)
+    {
+        e = churchterm(&g, &work[i]);
+        if (e == NULL)
+            goto freebuf;
+
+        rounds = 0;
+        start = now();
+        do
+        {
+            n = churchrun(e, &steps, &betas);
+            if (n != work[i].expect)
+            {
+                eprintf("lambda: %s %ld %ld gave %ld\n", work[i].name, work[i].a, work[i].b, n);
+                goto freebuf;
+            }
+            rounds += 1;
+            elapsed = now() - start;
+        } while (elapsed < benchseconds);
+
+        printf("%s %ld %ld: %lu steps, %lu betas, %ld rounds in %.3f s: %.1f ms each, %.1f Msteps/s\n",
+               work[i].name, work[i].a, work[i].b, steps, betas, rounds, elapsed, elapsed * 1e3 / (double)rounds,
+               (double)steps * (double)rounds / 1e6 / elapsed);
+        areset(Aast);
+    }
+
+    ret = EXIT_SUCCESS;
+freebuf:
+    free(g.buf);
+    afree(Aeval);
+    afree(Aast);
+    return ret;
+}
+
+static void usage(void)
+{
+    eprintf("usage: lambda [parse | whnf | norm | gen nodes [seed] | bench [mib] | church]\n"
+            "  with no command, show some terms and test the parser and evaluator\n"
+            "  parse  read a term from stdin and show it\n"
+            "  whnf   read a term from stdin and show its weak head normal form\n"
+            "  norm   read a term from stdin and show its normal form\n"
+            "  gen    print a random term of this many nodes\n"
+            "  bench  parse a generated term of this many MiB (default %ld, at most %ld) in a loop\n"
+            "  church time the evaluator on Church numeral arithmetic\n",
+            benchmib, maxbenchmib);
+    exit(EXIT_FAILURE);
+}
+
+/* A count argument: a positive decimal number, else usage. */
+static long positive(char const *arg)
+{
+    char *end;
+    long n;
+
+    errno = 0;
+    n = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || errno != 0 || n < 1)
+        usage();
+    return n;
+}
+
+static uint64_t seedarg(char const *arg)
+{
+    char *end;
+    unsigned long n;
+
+    errno = 0;
+    n = strtoul(arg, &end, 10);
+    if (end == arg || *end != '\0' || errno != 0 || arg[0] == '-')
+        usage();
+    return (uint64_t)n;
+}
+
+int main(int argc, char *argv[])
 {
     int ret = EXIT_FAILURE;
     struct Expr *xvar, *yvar, *tvar;
     struct Expr *id, *kinner, *k;
     struct Expr *app;
+    long mib;
+
+    if (argc > 1 && strcmp(argv[1], "parse") == 0 && argc == 2)
+        return parsefile(stdin, Pshow);
+    if (argc > 1 && strcmp(argv[1], "whnf") == 0 && argc == 2)
+        return parsefile(stdin, Pwhnf);
+    if (argc > 1 && strcmp(argv[1], "norm") == 0 && argc == 2)
+        return parsefile(stdin, Pnorm);
+    if (argc > 2 && strcmp(argv[1], "gen") == 0 && argc <= 4)
+        return gen(positive(argv[2]), (argc > 3) ? seedarg(argv[3]) : 1);
+    if (argc > 1 && strcmp(argv[1], "bench") == 0 && argc <= 3)
+    {
+        mib = (argc > 2) ? positive(argv[2]) : benchmib;
+        if (mib > maxbenchmib)
+            usage();
+        return bench(mib);
+    }
+    if (argc > 1 && strcmp(argv[1], "church") == 0 && argc == 2)
+        return churchbench();
+    if (argc > 1)
+        usage();
 
     /* (\x . x) */
     xvar = varcreate("x");
@@ -258,10 +1666,14 @@ int main(void)
 
     show(app, stdout);
 
+    if (!selftest())
+        goto freearenas;
+
     ret = EXIT_SUCCESS;
 
 freearenas:
-    afree(1);
-    afree(0);
+    afree(Aeval);
+    afree(Astack);
+    afree(Aast);
     return ret;
 }
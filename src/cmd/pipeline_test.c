@@ -0,0 +1,286 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bits.h"
+#include "printf.h"
+
+static size_t const cap = 8U;
+
+static intptr_t const count = 20000;
+
+/* spin rounds per unit of v % 7 in the jitter stage, so its workers finish
+ * out of order */
+static int const jitterspin = 200;
+
+enum
+{
+    nracers = 4
+};
+
+static int twice(void *arg, Message *m)
+{
+    (void)arg;
+    m->value *= 2;
+    return 0;
+}
+
+/* drops the doubles of multiples of 3 */
+static int sieve(void *arg, Message *m)
+{
+    (void)arg;
+    return m->value % 3 == 0;
+}
+
+static int jitter(void *arg, Message *m)
+{
+    volatile int spin;
+    int i;
+
+    (void)arg;
+    for (i = 0, spin = 0; i < (int)(m->value % 7) * jitterspin; ++i)
+        spin += i;
+
+    m->value += 1;
+    return 0;
+}
+
+static void *produce(void *data)
+{
+    Pipeline *p = data;
+    Message m;
+    intptr_t i;
+
+    m.tag = Tsome;
+    for (i = 0; i < count; ++i)
+    {
+        m.value = i;
+        if (pipelineput(p, &m) != 0)
+            break;
+    }
+
+    pipelineclose(p);
+    return NULL;
+}
+
+static Pipeline *build(int ordered)
+{
+    Pipeline *p;
+
+    p = pipelinecreate(cap);
+    if (p == NULL)
+        return NULL;
+
+    if (pipelinestage(p, "twice", twice, NULL, 1, 0) != 0 || pipelinestage(p, "sieve", sieve, NULL, 3, 0) != 1 ||
+        pipelinestage(p, "jitter", jitter, NULL, 4, ordered) != 2 || pipelinestart(p) != 0 ||
+        pipelinestage(p, "late", twice, NULL, 1, 0) != -1)
+    {
+        pipelinedestroy(p);
+        return NULL;
+    }
+
+    return p;
+}
+
+/* Every stage saw its share and the accounted time fits in the elapsed time. */
+static int checkstats(Pipeline *p, uint64_t const *items)
+{
+    Stagestats s;
+    int i;
+
+    for (i = 0; i < 3; ++i)
+    {
+        if (pipelinestats(p, i, &s) != 0 || s.items != items[i] || s.busyns + s.idlens + s.blockedns > s.elapsedns)
+        {
+            eprintf("stage %d: %lu items, expected %lu\n", i, (unsigned long)s.items, (unsigned long)items[i]);
+            return 0;
+        }
+    }
+
+    return pipelinestats(p, 3, &s) == -1;
+}
+
+/* The ordered last stage restores the input order around the dropped messages. */
+static int ordered(void)
+{
+    int rc, ret = 0;
+    intptr_t i = 0;
+    uint64_t items[3];
+    Pipeline *p;
+    Message m;
+    pthread_t tid;
+
+    p = build(1);
+    if (p == NULL || pthread_create(&tid, NULL, produce, p) != 0)
+        goto destroyp;
+
+    while ((rc = pipelineget(p, &m)) == 0)
+    {
+        if (i % 3 == 0)
+            i += 1;
+        if (m.value != 2 * i + 1)
+        {
+            eprintf("ordered: got %" PRIdPTR ", expected %" PRIdPTR "\n", m.value, 2 * i + 1);
+            break;
+        }
+        i += 1;
+    }
+
+    (void)pthread_join(tid, NULL);
+    if (rc != 2 || i != count)
+        goto destroyp;
+
+    /* dropped messages still pass through the ordered stage */
+    items[0] = items[1] = items[2] = (uint64_t)count;
+    ret = checkstats(p, items);
+destroyp:
+    pipelinedestroy(p);
+    return ret;
+}
+
+static int unordered(void)
+{
+    int rc, ret = 0;
+    intptr_t n = 0, sum = 0, expect = 0, i;
+    uint64_t items[3];
+    Pipeline *p;
+    Message m;
+    pthread_t tid;
+
+    for (i = 0; i < count; ++i)
+    {
+        if (i % 3 != 0)
+            expect += 2 * i + 1;
+    }
+
+    p = build(0);
+    if (p == NULL || pthread_create(&tid, NULL, produce, p) != 0)
+        goto destroyp;
+
+    while ((rc = pipelineget(p, &m)) == 0)
+    {
+        n += 1;
+        sum += m.value;
+    }
+
+    (void)pthread_join(tid, NULL);
+    if (rc != 2 || sum != expect)
+    {
+        eprintf("unordered: %" PRIdPTR " messages summing to %" PRIdPTR ", expected %" PRIdPTR "\n", n, sum, expect);
+        goto destroyp;
+    }
+
+    items[0] = items[1] = (uint64_t)count;
+    items[2] = (uint64_t)n;
+    ret = checkstats(p, items);
+destroyp:
+    pipelinedestroy(p);
+    return ret;
+}
+
+typedef struct Racer Racer;
+
+struct Racer
+{
+    Pipeline *p;
+    intptr_t accepted;
+};
+
+/* puts until the pipeline closes, counting the puts it accepted */
+static void *race(void *data)
+{
+    Racer *r = data;
+    Message m;
+
+    m.tag = Tsome;
+    m.value = 1;
+    while (pipelineput(r->p, &m) == 0)
+        r->accepted += 1;
+
+    return NULL;
+}
+
+/* Producers racing the close: every put that returned 0 still comes out
+ * of the ordered stage, so the sequence has no gap. */
+static int closing(void)
+{
+    int i, rc, ret = 0;
+    intptr_t n = 0, accepted = 0;
+    Pipeline *p;
+    Racer r[nracers];
+    pthread_t tid[nracers];
+    Message m;
+
+    p = build(1);
+    if (p == NULL)
+        return 0;
+
+    for (i = 0; i < nracers; ++i)
+    {
+        r[i].p = p;
+        r[i].accepted = 0;
+        if (pthread_create(&tid[i], NULL, race, &r[i]) != 0)
+            goto destroyp;
+    }
+
+    while (n < count && (rc = pipelineget(p, &m)) == 0)
+        n += 1;
+
+    pipelineclose(p);
+    while ((rc = pipelineget(p, &m)) == 0)
+        n += 1;
+
+    for (i = 0; i < nracers; ++i)
+    {
+        (void)pthread_join(tid[i], NULL);
+        accepted += r[i].accepted;
+    }
+
+    ret = (rc == 2 && n == accepted);
+    if (!ret)
+        eprintf("closing: %" PRIdPTR " out of %" PRIdPTR " accepted\n", n, accepted);
+destroyp:
+    pipelinedestroy(p);
+    return ret;
+}
+
+/* Destroying a pipeline that nobody drains returns, with workers blocked
+ * on its full last channel. */
+static int abandoned(void)
+{
+    Pipeline *p;
+    Message m;
+    size_t i;
+    struct timespec ts;
+
+    p = build(1);
+    if (p == NULL)
+        return 0;
+
+    m.tag = Tsome;
+    for (i = 0; i < 4 * cap; ++i)
+    {
+        m.value = (intptr_t)i;
+        if (pipelineput(p, &m) != 0)
+            return 0;
+    }
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = 10000000;
+    (void)nanosleep(&ts, NULL);
+
+    pipelinedestroy(p);
+    return 1;
+}
+
+int main(void)
+{
+    if (pipelinecreate(0) != NULL)
+        return EXIT_FAILURE;
+
+    if (!ordered() || !unordered() || !closing() || !abandoned())
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,198 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "bits.h"
+#include "macro.h"
+#include "printf.h"
+
+/* task tree: each task below depth spawns fanout children from its worker */
+static int const depth = 6;
+static int const fanout = 4;
+
+static int const nexternal = 10000;
+static int const nfed = 10000;
+
+static size_t const feedcap = 64;
+
+typedef struct Node Node;
+
+struct Node
+{
+    Pool *pool;
+    int depth;
+    long *count;
+};
+
+static long leaves(void)
+{
+    long n = 1;
+    int i;
+
+    for (i = 0; i < depth; ++i)
+        n *= fanout;
+    return n;
+}
+
+static void spawn(void *data)
+{
+    Node *n = data;
+    Node *child;
+    int i;
+
+    if (n->depth == depth)
+    {
+        __atomic_fetch_add(n->count, 1, __ATOMIC_RELAXED);
+        free(n);
+        return;
+    }
+
+    for (i = 0; i < fanout; ++i)
+    {
+        child = malloc(sizeof(*child));
+        if (child == NULL)
+            abort();
+
+        *child = *n;
+        child->depth = n->depth + 1;
+        if (poolsubmit(n->pool, spawn, child) != 0)
+            abort();
+    }
+
+    free(n);
+}
+
+static void add(void *data)
+{
+    __atomic_fetch_add((long *)data, 1, __ATOMIC_RELAXED);
+}
+
+static long fedsum;
+
+static void addvalue(void *data)
+{
+    __atomic_fetch_add(&fedsum, (long)(intptr_t)data, __ATOMIC_RELAXED);
+}
+
+static void waitinside(void *data)
+{
+    Pool *p = data;
+
+    if (poolwait(p) != -1)
+        abort();
+}
+
+/* Nested submits spread over the workers and poolwait covers all of them. */
+static int tree(Pool *p)
+{
+    long count = 0;
+    Node *root;
+
+    root = malloc(sizeof(*root));
+    if (root == NULL)
+        return 0;
+
+    root->pool = p;
+    root->depth = 0;
+    root->count = &count;
+
+    if (poolsubmit(p, spawn, root) != 0 || poolwait(p) != 0)
+        return 0;
+
+    if (count != leaves())
+    {
+        eprintf("tree: %ld leaves, expected %ld\n", count, leaves());
+        return 0;
+    }
+
+    return 1;
+}
+
+/* Submits from a thread outside the pool, and poolwait refused inside a task. */
+static int external(Pool *p)
+{
+    long count = 0;
+    int i;
+
+    for (i = 0; i < nexternal; ++i)
+    {
+        if (poolsubmit(p, add, &count) != 0)
+            return 0;
+    }
+
+    if (poolsubmit(p, waitinside, p) != 0 || poolwait(p) != 0)
+        return 0;
+
+    if (count != nexternal)
+    {
+        eprintf("external: %ld tasks ran, expected %d\n", count, nexternal);
+        return 0;
+    }
+
+    return 1;
+}
+
+/* Every message put before pooldestroy runs, including those still queued. */
+static int fed(int nworkers)
+{
+    int i;
+    long expect = 0;
+    Pool *p;
+    Channel *c;
+    Message m;
+
+    p = poolcreate(nworkers);
+    c = channelcreatekind(feedcap, Cmpmc);
+    if (p == NULL || c == NULL || poolfeed(p, c, addvalue) != 0 || poolfeed(p, c, addvalue) != -1)
+        return 0;
+
+    m.tag = Tsome;
+    for (i = 1; i <= nfed; ++i)
+    {
+        m.value = i;
+        expect += i;
+        if (channelputwait(c, &m) != 0)
+            return 0;
+    }
+
+    pooldestroy(p);
+    channeldestroy(c);
+
+    if (fedsum != expect)
+    {
+        eprintf("fed: sum %ld, expected %ld\n", fedsum, expect);
+        return 0;
+    }
+
+    return 1;
+}
+
+int main(void)
+{
+    static int const workers[] = { 1, 3, 0 };
+    size_t i;
+    Pool *p;
+
+    if (poolcreate(-1) != NULL)
+        return EXIT_FAILURE;
+
+    for (i = 0; i < NELEM(workers); ++i)
+    {
+        p = poolcreate(workers[i]);
+        if (p == NULL)
+            return EXIT_FAILURE;
+
+        if (!tree(p) || !external(p))
+        {
+            eprintf("with %d workers\n", workers[i]);
+            return EXIT_FAILURE;
+        }
+
+        pooldestroy(p);
+
+        fedsum = 0;
+        if (!fed(workers[i]))
+            return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
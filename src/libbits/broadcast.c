@@ -0,0 +1,280 @@
+#include <stdlib.h>
+
+#include "bits.h"
+#include "futex.h"
+#include "macro.h"
+
+#define CACHELINE 64
+
+/* polls before a blocked call parks */
+static int const spinlimit = 256;
+
+/* cursor of a reader that unsubscribed, skipped by the gate */
+static size_t const gone = (size_t)-1;
+
+typedef struct Cell Cell;
+typedef struct Cursor Cursor;
+
+/* seq is position + 1 once the message for that position is published */
+struct Cell
+{
+    size_t seq;
+    Message message;
+};
+
+/* Next position a reader takes, stored only by that reader. */
+struct Cursor
+{
+    size_t pos;
+    char pad[CACHELINE - sizeof(size_t)];
+};
+
+/* The disruptor pattern (Thompson et al., "Disruptor: High performance
+ * alternative to bounded queues for exchanging data between concurrent
+ * threads"): writers claim positions in one ring and every reader walks it
+ * with its own cursor, so a message is written once and read by all.  A
+ * writer may reuse a cell only once every cursor has passed it: the
+ * slowest reader gates the writers. */
+struct Broadcast
+{
+    size_t capacity;
+    size_t mask; /**< capacity - 1 for power-of-two capacities, else 0 */
+    int maxreaders;
+    int nreaders;
+    int started; /**< Set by the first put; no subscriptions after it */
+    int closed;
+
+    char pad0[CACHELINE];
+    size_t claim; /**< Next position to write, advanced by compare-and-swap */
+    size_t gate;  /**< Writers' last view of the slowest cursor */
+    char pad1[CACHELINE - 2 * sizeof(size_t)];
+
+    Event notempty; /**< Readers park here, every put notifies */
+    char pad2[CACHELINE - sizeof(Event)];
+    Event notfull; /**< Writers park here, every get notifies */
+    char pad3[CACHELINE - sizeof(Event)];
+
+    Cursor *cursors;
+    Cell *cells;
+};
+
+static Cell *cell(Broadcast *b, size_t pos)
+{
+    return &b->cells[(b->mask != 0) ? pos & b->mask : pos % b->capacity];
+}
+
+/* The slowest subscribed cursor, or limit when it is at limit or beyond or
+ * nobody reads. */
+static size_t slowest(Broadcast *b, size_t limit)
+{
+    size_t pos, min = limit;
+    int i;
+
+    for (i = 0; i < b->nreaders; ++i)
+    {
+        pos = __atomic_load_n(&b->cursors[i].pos, __ATOMIC_ACQUIRE);
+        if (pos != gone && (ptrdiff_t)(pos - min) < 0)
+            min = pos;
+    }
+
+    return min;
+}
+
+/* 1 when put, 0 when the slowest reader is a whole ring behind, 2 once closed */
+static int tryput(Broadcast *b, Message *in)
+{
+    size_t pos, gate;
+    Cell *c;
+
+    if (__atomic_load_n(&b->closed, __ATOMIC_ACQUIRE))
+        return 2;
+
+    /* gate is passed on with release and acquire, so that the reads which
+     * let a cursor past a cell happen before the write that reuses it */
+    pos = __atomic_load_n(&b->claim, __ATOMIC_RELAXED);
+    do
+    {
+        gate = __atomic_load_n(&b->gate, __ATOMIC_ACQUIRE);
+        if (pos - gate >= b->capacity)
+        {
+            gate = slowest(b, pos);
+            __atomic_store_n(&b->gate, gate, __ATOMIC_RELEASE);
+            if (pos - gate >= b->capacity)
+                return 0;
+        }
+    } while (!__atomic_compare_exchange_n(&b->claim, &pos, pos + 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    c = cell(b, pos);
+    c->message = *in;
+    __atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+
+    eventnotify(&b->notempty);
+    return 1;
+}
+
+/* 1 when taken, 0 when reader id has seen everything, 2 once also closed */
+static int tryget(Broadcast *b, int id, Message *out)
+{
+    size_t pos = b->cursors[id].pos;
+    Cell *c = cell(b, pos);
+
+    if (__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) != pos + 1)
+    {
+        /* puts claimed before the close are published soon: drain them too */
+        if (!__atomic_load_n(&b->closed, __ATOMIC_ACQUIRE) ||
+            (ptrdiff_t)(__atomic_load_n(&b->claim, __ATOMIC_ACQUIRE) - pos) > 0)
+            return 0;
+        return 2;
+    }
+
+    *out = c->message;
+    __atomic_store_n(&b->cursors[id].pos, pos + 1, __ATOMIC_RELEASE);
+
+    eventnotify(&b->notfull);
+    return 1;
+}
+
+/* tryput and tryget results as channel return values */
+static int single(int rc)
+{
+    return (rc == 1) ? 0 : 1 + (rc == 2);
+}
+
+Broadcast *broadcastcreate(size_t capacity, int maxreaders)
+{
+    Broadcast *b;
+
+    if (capacity == 0 || maxreaders < 1)
+        return NULL;
+
+    b = calloc(1, sizeof(*b));
+    if (b == NULL)
+        return NULL;
+
+    b->cursors = calloc((size_t)maxreaders, sizeof(*b->cursors));
+    b->cells = calloc(capacity, sizeof(*b->cells));
+    if (b->cursors == NULL || b->cells == NULL)
+    {
+        broadcastdestroy(b);
+        return NULL;
+    }
+
+    b->capacity = capacity;
+    b->mask = ISPOW2(capacity) ? capacity - 1 : 0;
+    b->maxreaders = maxreaders;
+    eventinit(&b->notempty, 0, 0);
+    eventinit(&b->notfull, 0, 0);
+    return b;
+}
+
+int broadcastsubscribe(Broadcast *b)
+{
+    if (b == NULL || __atomic_load_n(&b->started, __ATOMIC_ACQUIRE) || b->nreaders == b->maxreaders)
+        return -1;
+
+    return b->nreaders++;
+}
+
+void broadcastunsubscribe(Broadcast *b, int id)
+{
+    if (b == NULL || id < 0 || id >= b->nreaders)
+        return;
+
+    __atomic_store_n(&b->cursors[id].pos, gone, __ATOMIC_RELEASE);
+    eventnotify(&b->notfull);
+}
+
+int broadcastput(Broadcast *b, Message *in)
+{
+    if (b == NULL || in == NULL)
+        return -1;
+
+    __atomic_store_n(&b->started, 1, __ATOMIC_RELEASE);
+    return single(tryput(b, in));
+}
+
+int broadcastputwait(Broadcast *b, Message *in)
+{
+    int i, rc;
+    uint32_t key;
+
+    if (b == NULL || in == NULL)
+        return -1;
+
+    __atomic_store_n(&b->started, 1, __ATOMIC_RELEASE);
+
+    for (i = 0; i < spinlimit; ++i)
+    {
+        rc = tryput(b, in);
+        if (rc != 0)
+            return single(rc);
+        cpurelax();
+    }
+
+    for (;;)
+    {
+        key = eventprepare(&b->notfull);
+        rc = tryput(b, in);
+        if (rc != 0)
+            return single(rc);
+
+        if (eventwait(&b->notfull, key, NULL) != 0)
+            return -1;
+    }
+}
+
+int broadcastget(Broadcast *b, int id, Message *out)
+{
+    int i, rc;
+    uint32_t key;
+
+    if (b == NULL || id < 0 || id >= b->nreaders || out == NULL)
+        return -1;
+
+    for (i = 0; i < spinlimit; ++i)
+    {
+        rc = tryget(b, id, out);
+        if (rc != 0)
+            return single(rc);
+        cpurelax();
+    }
+
+    for (;;)
+    {
+        key = eventprepare(&b->notempty);
+        rc = tryget(b, id, out);
+        if (rc != 0)
+            return single(rc);
+
+        if (eventwait(&b->notempty, key, NULL) != 0)
+            return -1;
+    }
+}
+
+int broadcasttryget(Broadcast *b, int id, Message *out)
+{
+    if (b == NULL || id < 0 || id >= b->nreaders || out == NULL)
+        return -1;
+
+    return single(tryget(b, id, out));
+}
+
+void broadcastclose(Broadcast *b)
+{
+    if (b == NULL)
+        return;
+
+    __atomic_store_n(&b->closed, 1, __ATOMIC_SEQ_CST);
+    eventnotify(&b->notempty);
+    eventnotify(&b->notfull);
+}
+
+void broadcastdestroy(Broadcast *b)
+{
+    if (b == NULL)
+        return;
+
+    free(b->cells);
+    free(b->cursors);
+    free(b);
+}
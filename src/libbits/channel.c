@@ -1,272 +1,1207 @@
 #include <errno.h>
+#include <limits.h>
+#include <linux/memfd.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "bits.h"
+#include "futex.h"
+#include "macro.h"
 
+#define CACHELINE 64
+
+#ifdef BITS_STATS
+#    define TALLY(c, field, n) ((void)__atomic_fetch_add(&(c)->stats.field, (uint64_t)(n), __ATOMIC_RELAXED))
+#    define DEPTH(c, d) TALLY(c, depth[depthbucket(d)], 1)
+#else
+#    define TALLY(c, field, n) ((void)0)
+#    define DEPTH(c, d) ((void)0)
+#endif
+
+/* spin estimates adapt between these bounds; see waitfor */
+static int32_t const spininit = 64;
+static int32_t const spinmax = 4096;
+
+/* mask value for capacities that need a modulo */
+static size_t const nomask = (size_t)-1;
+
+/* keeps channelsize and batch counts within an int */
+static size_t const maxcapacity = INT_MAX;
+
+/* internal result of an operation on a closed channel */
+#define CLOSED (-2)
+
+/* set in waiting while channeldestroy waits for blocked callers to leave */
+#define DESTROYING 0x80000000U
+
+/* Cbytes: records and the ring itself start on this boundary */
+enum
+{
+    recalign = 16
+};
+
+/* Cbytes header size of the filler before a wrap */
+static size_t const skipmark = (size_t)-1;
+
+/* first word of a process-shared channel, checked by channelmap */
+static uint32_t const shmmagic = 0x43686e31; /* "Chn1" */
+
+/* Every blocked channelselect sleeps here; channels with selecting != 0
+ * notify it along with their own events.  One word for all selectors keeps
+ * a selector to a single futex however many channels it watches, at the
+ * price of waking unrelated selectors.  Initialized as eventinit(&selectors,
+ * spininit, 0) would: private to the process, whatever the channels are. */
+static Event selectors = { 0, 64, FUTEX_PRIVATE_FLAG };
+
+/* start of the next select sweep */
+static unsigned rotor;
+
+typedef struct Cell Cell;
+typedef struct Record Record;
+
+/* Cmpmc slot: seq is 2 * position while free for the put at that position
+ * and 2 * position + 1 once filled for the get; doubling keeps "full for the
+ * next lap" distinct from "free" even with a single slot */
+struct Cell
+{
+    size_t seq;
+    Message message;
+};
+
+/* Cbytes header, padded so that the payload after it is aligned like the
+ * record; size is the payload's length, or skipmark */
+struct Record
+{
+    size_t size;
+    char pad[recalign - sizeof(size_t)];
+};
+
+/* A channel and its ring are one block, the ring right after the struct, so
+ * that nothing in it is an address and a memfd holding the block works in
+ * every process that maps it. */
 struct Channel
 {
-    Message *buffer;       /**< Buffer to hold messages */
-    uint8_t capacity;      /**< Maximum size of the buffer */
-    size_t front;          /**< Index of the front message in the buffer */
-    size_t rear;           /**< Index of the rear message in the buffer */
-    sem_t *empty;          /**< Semaphore to track empty slots in the buffer */
-    sem_t *full;           /**< Semaphore to track filled slots in the buffer */
-    pthread_mutex_t *lock; /**< Mutex lock to protect buffer access */
+    uint32_t magic;       /**< shmmagic for process-shared channels, else 0 */
+    uint32_t headsize;    /**< sizeof(Channel), so channelmap rejects another layout */
+    size_t mapsize;       /**< Bytes in the block, the ring included */
+    size_t capacity;      /**< Maximum size of the buffer */
+    size_t mask;          /**< capacity - 1 for power-of-two capacities, else nomask */
+    int kind;             /**< Clocked, Cspsc, Cmpmc or Cbytes */
+    int closed;           /**< Set once by channelclose */
+    size_t front;         /**< Index of the front message in the buffer */
+    size_t rear;          /**< Index of the rear message in the buffer */
+    size_t count;         /**< Clocked: messages in the buffer */
+    pthread_mutex_t lock; /**< Clocked: protects the buffer */
+
+    /* Cspsc, Cmpmc and Cbytes: free-running counters, each beside its
+     * owner's cached copy of the other and a cache line away from everything
+     * the other side writes; Cmpmc claims positions with compare-and-swap
+     * and has no caches, Cbytes counts bytes */
+    char pad0[CACHELINE];
+    size_t tail;      /**< Next slot to write, stored only by the producer */
+    size_t headcache; /**< Producer's last view of head */
+    size_t skip;      /**< Cbytes: filler before the reserved record */
+    size_t reserved;  /**< Cbytes: bytes reserved from tail on, 0 for none */
+    char pad1[CACHELINE - 4 * sizeof(size_t)];
+    size_t head;      /**< Next slot to read, stored only by the consumer */
+    size_t tailcache; /**< Consumer's last view of tail */
+    size_t held;      /**< Cbytes: bytes of the acquired record, 0 for none */
+    char pad2[CACHELINE - 3 * sizeof(size_t)];
+
+    Event notempty; /**< Getters park here, every put notifies */
+    char pad3[CACHELINE - sizeof(Event)];
+    Event notfull; /**< Putters park here, every get notifies */
+    char pad4[CACHELINE - sizeof(Event)];
+    uint32_t waiting;   /**< Callers past their first attempt, plus DESTROYING */
+    uint32_t selecting; /**< Selectors asleep on this channel */
+    int fd;             /**< channelfd's eventfd, -1 until asked for */
+    int fdready;        /**< Set while fd is readable */
+#ifdef BITS_STATS
+    Channelstats stats; /**< Counters only; capacity and size are filled in by channelstats */
+#endif
 };
 
-static sem_t *semcreate(uint32_t value)
+typedef int Op(Channel *c, int n, Message *m);
+
+#ifdef BITS_STATS
+static size_t depthbucket(size_t depth)
 {
-    int rc;
-    sem_t *sem;
+    size_t b;
 
-    sem = calloc(1, sizeof(*sem));
-    if (sem == NULL)
-        return NULL;
+    for (b = 0; depth > 1 && b < NELEM(((Channelstats *)0)->depth) - 1; depth >>= 1)
+        b += 1;
+    return b;
+}
 
-    rc = sem_init(sem, 0, value);
-    if (rc == -1)
+static uint64_t nanos(void)
+{
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+/* pthread_mutex_lock, counting the acquisitions that found the lock held */
+static int lock(Channel *c)
+{
+#ifdef BITS_STATS
+    if (pthread_mutex_trylock(&c->lock) == 0)
+        return 0;
+    TALLY(c, contended, 1);
+#endif
+    return pthread_mutex_lock(&c->lock);
+}
+
+/* Clocked and Cspsc ring */
+static Message *buffer(Channel *c)
+{
+    return (Message *)(c + 1);
+}
+
+/* Cmpmc ring */
+static Cell *cells(Channel *c)
+{
+    return (Cell *)(c + 1);
+}
+
+/* n rounded up to a multiple of recalign */
+static size_t recround(size_t n)
+{
+    return (n + recalign - 1) & ~(size_t)(recalign - 1);
+}
+
+/* Cbytes ring */
+static unsigned char *records(Channel *c)
+{
+    return (unsigned char *)c + recround(sizeof(Channel));
+}
+
+/* Bytes for a channel and its ring, 0 for a bad capacity or kind. */
+static size_t blocksize(size_t capacity, int kind)
+{
+    if (capacity == 0 || capacity > maxcapacity)
+        return 0;
+
+    switch (kind)
     {
-        free(sem);
-        return NULL;
+    case Clocked:
+    case Cspsc:
+        return sizeof(Channel) + capacity * sizeof(Message);
+    case Cmpmc:
+        return sizeof(Channel) + capacity * sizeof(Cell);
+    case Cbytes:
+        return (recround(capacity) > maxcapacity) ? 0 : recround(sizeof(Channel)) + recround(capacity);
+    default:
+        return 0;
     }
+}
+
+/* Set up a zeroed block of blocksize bytes; shared makes the lock and the
+ * futexes work between processes. */
+static int channelinit(Channel *c, size_t capacity, int kind, int shared)
+{
+    size_t i;
+    pthread_mutexattr_t attr;
 
-    return sem;
+    c->headsize = sizeof(Channel);
+    c->mapsize = blocksize(capacity, kind);
+
+    if (kind == Cbytes)
+        capacity = recround(capacity);
+
+    if (kind == Cmpmc)
+    {
+        for (i = 0; i < capacity; ++i)
+            cells(c)[i].seq = 2 * i;
+    }
+
+    c->capacity = capacity;
+    c->mask = ISPOW2(capacity) ? capacity - 1 : nomask;
+    c->kind = kind;
+    c->closed = 0;
+    c->waiting = 0;
+    c->selecting = 0;
+    c->fd = -1;
+    c->fdready = 0;
+    c->front = 0;
+    c->rear = 0;
+    c->count = 0;
+    c->tail = c->headcache = 0;
+    c->skip = c->reserved = 0;
+    c->head = c->tailcache = 0;
+    c->held = 0;
+    eventinit(&c->notempty, spininit, shared);
+    eventinit(&c->notfull, spininit, shared);
+
+    /* the ring kinds need no lock */
+    if (kind != Clocked)
+        return 0;
+
+    if (pthread_mutexattr_init(&attr) != 0)
+        return -1;
+
+    if (pthread_mutexattr_setpshared(&attr, shared ? PTHREAD_PROCESS_SHARED : PTHREAD_PROCESS_PRIVATE) != 0 ||
+        pthread_mutex_init(&c->lock, &attr) != 0)
+    {
+        (void)pthread_mutexattr_destroy(&attr);
+        return -1;
+    }
+
+    (void)pthread_mutexattr_destroy(&attr);
+    return 0;
 }
 
-static void semdestroy(sem_t *sem)
+static void channelfinish(Channel *c)
 {
-    if (sem == NULL)
+    if (c == NULL)
         return;
 
-    sem_destroy(sem);
-    free(sem);
+    if (c->kind == Clocked)
+        (void)pthread_mutex_destroy(&c->lock);
+
+    if (c->fd >= 0)
+    {
+        (void)close(c->fd);
+        c->fd = -1;
+    }
+}
+
+Channel *channelcreate(size_t capacity)
+{
+    return channelcreatekind(capacity, Clocked);
 }
 
-static pthread_mutex_t *mutexcreate(void)
+Channel *channelcreatekind(size_t capacity, int kind)
 {
     int rc;
-    pthread_mutex_t *mutex;
+    size_t size;
+    Channel *c;
 
-    mutex = calloc(1, sizeof(pthread_mutex_t));
-    if (mutex == NULL)
+    size = blocksize(capacity, kind);
+    if (size == 0)
         return NULL;
 
-    rc = pthread_mutex_init(mutex, NULL);
+    c = calloc(1, size);
+    if (c == NULL)
+        return NULL;
+
+    rc = channelinit(c, capacity, kind, 0);
     if (rc != 0)
     {
-        free(mutex);
+        free(c);
         return NULL;
     }
 
-    return mutex;
+    return c;
 }
 
-static void mutexdestroy(pthread_mutex_t *mutex)
+Channel *channelshm(size_t capacity, int kind, int *fd)
 {
-    if (mutex == NULL)
-        return;
+    int memfd;
+    size_t size;
+    Channel *c;
 
-    pthread_mutex_destroy(mutex);
-    free(mutex);
+    size = blocksize(capacity, kind);
+    if (size == 0 || fd == NULL)
+        return NULL;
+
+    /* glibc only declares memfd_create for _GNU_SOURCE */
+    memfd = (int)syscall(SYS_memfd_create, "channel", MFD_CLOEXEC);
+    if (memfd < 0)
+        return NULL;
+
+    /* a new memfd reads as zeros, as channelinit expects */
+    if (ftruncate(memfd, (off_t)size) != 0)
+        goto closefd;
+
+    c = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (c == MAP_FAILED)
+        goto closefd;
+
+    if (channelinit(c, capacity, kind, 1) != 0)
+    {
+        (void)munmap(c, size);
+        goto closefd;
+    }
+
+    /* published last: channelmap rejects the block until it is complete */
+    __atomic_store_n(&c->magic, shmmagic, __ATOMIC_RELEASE);
+
+    *fd = memfd;
+    return c;
+
+closefd:
+    (void)close(memfd);
+    return NULL;
 }
 
-static int channelinit(Channel *c, uint8_t capacity)
+Channel *channelmap(int fd)
 {
-    if (c == NULL || capacity == 0)
-        return -1;
+    struct stat st;
+    Channel *c;
 
-    c->buffer = calloc((size_t)capacity, sizeof(*c->buffer));
-    if (c->buffer == NULL)
-        return -1;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Channel))
+        return NULL;
 
-    c->capacity = capacity;
-    c->front = 0;
-    c->rear = 0;
+    c = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (c == MAP_FAILED)
+        return NULL;
 
-    c->empty = semcreate(capacity);
-    if (c->empty == NULL)
-        goto freebuffer;
+    if (__atomic_load_n(&c->magic, __ATOMIC_ACQUIRE) != shmmagic || c->headsize != sizeof(Channel) ||
+        c->mapsize != (size_t)st.st_size || blocksize(c->capacity, c->kind) != c->mapsize)
+    {
+        (void)munmap(c, (size_t)st.st_size);
+        return NULL;
+    }
 
-    c->full = semcreate(0);
-    if (c->full == NULL)
-        goto destroyempty;
+    return c;
+}
+
+/* Wake the waiters on e and any selectors watching c.  eventnotify's fence
+ * also orders the selecting load after the caller's update of c. */
+static void notify(Channel *c, Event *e)
+{
+    eventnotify(e);
+    if (__atomic_load_n(&c->selecting, __ATOMIC_RELAXED) != 0)
+        eventnotify(&selectors);
+}
 
-    c->lock = mutexcreate();
-    if (c->lock == NULL)
-        goto destroyfull;
+/* Make channelfd readable unless it already is; only the put that finds
+ * fdready clear pays for the write. */
+static void fdsignal(Channel *c)
+{
+    uint64_t one = 1;
+    int fd = __atomic_load_n(&c->fd, __ATOMIC_ACQUIRE);
 
-    return 0;
+    if (fd < 0 || __atomic_load_n(&c->fdready, __ATOMIC_RELAXED))
+        return;
 
-destroyfull:
-    semdestroy(c->full);
-destroyempty:
-    semdestroy(c->empty);
-freebuffer:
-    free(c->buffer);
-    return -1;
+    if (__atomic_exchange_n(&c->fdready, 1, __ATOMIC_SEQ_CST) == 0)
+        (void)write(fd, &one, sizeof(one));
 }
 
-static void channelfinish(Channel *c)
+/* A get found the channel empty: clear channelfd's readability, then look
+ * again, since a put that saw fdready still set did not write.  The read
+ * comes first: a put that sees fdready clear writes, and reading after that
+ * write would swallow it. */
+static void fdrearm(Channel *c)
+{
+    uint64_t count;
+    int fd = __atomic_load_n(&c->fd, __ATOMIC_ACQUIRE);
+
+    if (fd < 0 || !__atomic_load_n(&c->fdready, __ATOMIC_RELAXED))
+        return;
+
+    (void)read(fd, &count, sizeof(count));
+    if (__atomic_exchange_n(&c->fdready, 0, __ATOMIC_SEQ_CST) == 0)
+        return;
+
+    if (channelsize(c) != 0 || __atomic_load_n(&c->closed, __ATOMIC_SEQ_CST))
+        fdsignal(c);
+}
+
+void channelclose(Channel *c)
 {
     if (c == NULL)
         return;
 
-    c->capacity = 0;
-    c->front = 0;
-    c->rear = 0;
+    __atomic_store_n(&c->closed, 1, __ATOMIC_SEQ_CST);
+    notify(c, &c->notempty);
+    notify(c, &c->notfull);
+    fdsignal(c);
+}
+
+int channelfd(Channel *c)
+{
+    int fd, expect = -1;
+
+    /* an eventfd would only wake this process */
+    if (c == NULL || c->magic == shmmagic)
+        return -1;
 
-    if (c->buffer != NULL)
+    fd = __atomic_load_n(&c->fd, __ATOMIC_ACQUIRE);
+    if (fd >= 0)
+        return fd;
+
+    fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    /* two first callers race to install theirs; the loser uses the winner's */
+    if (!__atomic_compare_exchange_n(&c->fd, &expect, fd, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
     {
-        free(c->buffer);
-        c->buffer = NULL;
+        (void)close(fd);
+        return expect;
     }
-    if (c->empty != NULL)
+
+    /* messages already queued, or a close, must show too */
+    if (channelsize(c) != 0 || __atomic_load_n(&c->closed, __ATOMIC_SEQ_CST))
+        fdsignal(c);
+
+    return fd;
+}
+
+void channeldestroy(Channel *c)
+{
+    uint32_t w;
+
+    if (c == NULL)
+        return;
+
+    /* other processes may still be using a shared channel: only unmap it */
+    if (c->magic == shmmagic)
     {
-        semdestroy(c->empty);
-        c->empty = NULL;
+        (void)munmap(c, c->mapsize);
+        return;
     }
-    if (c->full != NULL)
+
+    /* wake every blocked caller and sleep until the last one has left */
+    channelclose(c);
+
+    w = __atomic_or_fetch(&c->waiting, DESTROYING, __ATOMIC_SEQ_CST);
+    while (w != DESTROYING)
     {
-        semdestroy(c->full);
-        c->full = NULL;
+        (void)futexwait(&c->waiting, w, NULL, FUTEX_PRIVATE_FLAG);
+        w = __atomic_load_n(&c->waiting, __ATOMIC_ACQUIRE);
     }
-    if (c->lock != NULL)
+
+    channelfinish(c);
+    free(c);
+}
+
+/* Position to index: a mask for power-of-two capacities, a division otherwise. */
+static size_t slot(Channel const *c, size_t pos)
+{
+    return (c->mask != nomask) ? pos & c->mask : pos % c->capacity;
+}
+
+/* Copy n messages into or out of the ring at index i, wrapping at most once. */
+static void ringcopy(Message *ring, size_t capacity, size_t i, Message *m, size_t n, int in)
+{
+    size_t first = (n < capacity - i) ? n : capacity - i;
+
+    if (in)
     {
-        mutexdestroy(c->lock);
-        c->lock = NULL;
+        memcpy(ring + i, m, first * sizeof(*m));
+        memcpy(ring, m + first, (n - first) * sizeof(*m));
+    }
+    else
+    {
+        memcpy(m, ring + i, first * sizeof(*m));
+        memcpy(m + first, ring, (n - first) * sizeof(*m));
     }
 }
 
-Channel *channelcreate(uint8_t capacity)
+/* The kind-specific operations below move up to n messages and return how
+ * many moved: 0 when the channel is full (put) or empty (get), -1 on error. */
+
+static int lockedput(Channel *c, int n, Message *in)
 {
-    int rc;
-    Channel *c;
+    size_t k;
 
-    c = calloc(1, sizeof(*c));
-    if (c == NULL)
-        return NULL;
+    if (lock(c) != 0)
+        return -1;
 
-    rc = channelinit(c, capacity);
-    if (rc != 0)
+    k = c->capacity - c->count;
+    if ((size_t)n < k)
+        k = (size_t)n;
+
+    ringcopy(buffer(c), c->capacity, c->rear, in, k, 1);
+    c->rear = slot(c, c->rear + k);
+    c->count += k;
+    if (k > 0)
+        DEPTH(c, c->count);
+
+    return (pthread_mutex_unlock(&c->lock) == 0) ? (int)k : -1;
+}
+
+static int lockedget(Channel *c, int n, Message *out)
+{
+    size_t k;
+
+    if (lock(c) != 0)
+        return -1;
+
+    k = c->count;
+    if ((size_t)n < k)
+        k = (size_t)n;
+
+    ringcopy(buffer(c), c->capacity, c->front, out, k, 0);
+    c->front = slot(c, c->front + k);
+    c->count -= k;
+
+    return (pthread_mutex_unlock(&c->lock) == 0) ? (int)k : -1;
+}
+
+/* Only the producer stores tail and only the consumer stores head; each
+ * re-reads the other's counter only when its cached copy says there is not
+ * enough room or data for the whole request. */
+static int spscput(Channel *c, int n, Message *in)
+{
+    size_t const tail = c->tail;
+    size_t k;
+
+    k = c->capacity - (tail - c->headcache);
+    if (k < (size_t)n)
     {
-        free(c);
-        return NULL;
+        c->headcache = __atomic_load_n(&c->head, __ATOMIC_ACQUIRE);
+        k = c->capacity - (tail - c->headcache);
     }
+    if ((size_t)n < k)
+        k = (size_t)n;
 
-    return c;
+    ringcopy(buffer(c), c->capacity, slot(c, tail), in, k, 1);
+    __atomic_store_n(&c->tail, tail + k, __ATOMIC_RELEASE);
+    if (k > 0)
+        DEPTH(c, tail + k - c->headcache);
+    return (int)k;
 }
 
-void channeldestroy(Channel *c)
+static int spscget(Channel *c, int n, Message *out)
 {
-    int f, e;
+    size_t const head = c->head;
+    size_t k;
 
-    if (c == NULL)
-        return;
+    k = c->tailcache - head;
+    if (k < (size_t)n)
+    {
+        c->tailcache = __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE);
+        k = c->tailcache - head;
+    }
+    if ((size_t)n < k)
+        k = (size_t)n;
+
+    ringcopy(buffer(c), c->capacity, slot(c, head), out, k, 0);
+    __atomic_store_n(&c->head, head + k, __ATOMIC_RELEASE);
+    return (int)k;
+}
+
+/* Vyukov's bounded queue: a put or get claims positions by advancing tail
+ * or head with compare-and-swap once the cells' sequences show they are
+ * ready, then publishes each cell by storing the next sequence for the other
+ * side.  A cell that is ready for position p stays so until p is claimed,
+ * so a batch can check its cells first and claim them all with one swap. */
+static int mpmcput(Channel *c, int n, Message *in)
+{
+    size_t pos, seq = 0, k, i;
+    Cell *cell;
 
-    do
+    pos = __atomic_load_n(&c->tail, __ATOMIC_RELAXED);
+    for (;;)
     {
-        sem_getvalue(c->empty, &e);
-        sem_getvalue(c->full, &f);
+        for (k = 0; k < (size_t)n; ++k)
+        {
+            seq = __atomic_load_n(&cells(c)[slot(c, pos + k)].seq, __ATOMIC_ACQUIRE);
+            if (seq != 2 * (pos + k))
+                break;
+        }
 
-        if (f > 0)
+        if (k > 0)
         {
-            sem_wait(c->full);
-            sem_post(c->full);
+            if (__atomic_compare_exchange_n(&c->tail, &pos, pos + k, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
         }
-    } while (f > 0 || e != c->capacity);
+        else if ((ptrdiff_t)(seq - 2 * pos) < 0)
+            return 0;
+        else
+            pos = __atomic_load_n(&c->tail, __ATOMIC_RELAXED);
+    }
 
-    channelfinish(c);
-    free(c);
+    for (i = 0; i < k; ++i)
+    {
+        cell = &cells(c)[slot(c, pos + i)];
+        cell->message = in[i];
+        __atomic_store_n(&cell->seq, 2 * (pos + i) + 1, __ATOMIC_RELEASE);
+    }
+
+    DEPTH(c, pos + k - __atomic_load_n(&c->head, __ATOMIC_RELAXED));
+    return (int)k;
 }
 
-int channelput(Channel *c, struct Message *in)
+static int mpmcget(Channel *c, int n, Message *out)
+{
+    size_t pos, seq = 0, k, i;
+    Cell *cell;
+
+    pos = __atomic_load_n(&c->head, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        for (k = 0; k < (size_t)n; ++k)
+        {
+            seq = __atomic_load_n(&cells(c)[slot(c, pos + k)].seq, __ATOMIC_ACQUIRE);
+            if (seq != 2 * (pos + k) + 1)
+                break;
+        }
+
+        if (k > 0)
+        {
+            if (__atomic_compare_exchange_n(&c->head, &pos, pos + k, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if ((ptrdiff_t)(seq - (2 * pos + 1)) < 0)
+            return 0;
+        else
+            pos = __atomic_load_n(&c->head, __ATOMIC_RELAXED);
+    }
+
+    for (i = 0; i < k; ++i)
+    {
+        cell = &cells(c)[slot(c, pos + i)];
+        out[i] = cell->message;
+        __atomic_store_n(&cell->seq, 2 * (pos + i + c->capacity), __ATOMIC_RELEASE);
+    }
+
+    return (int)k;
+}
+
+static int isclosed(Channel *c)
+{
+    return __atomic_load_n(&c->closed, __ATOMIC_ACQUIRE);
+}
+
+/* Non-blocking put of up to n messages for any kind; CLOSED once closed. */
+static int tryput(Channel *c, int n, Message *in)
 {
     int rc;
 
-    if (c == NULL || in == NULL)
-        return -1;
+    if (isclosed(c))
+        return CLOSED;
 
-    rc = sem_trywait(c->empty);
-    if (rc == -1)
-        return (errno == EAGAIN) ? 1 : -1;
+    if (c->kind == Cbytes)
+        return -1;
+    if (c->kind == Cspsc)
+        rc = spscput(c, n, in);
+    else if (c->kind == Cmpmc)
+        rc = mpmcput(c, n, in);
+    else
+        rc = lockedput(c, n, in);
 
-    rc = pthread_mutex_lock(c->lock);
-    if (rc != 0)
+    if (rc > 0)
     {
-        sem_post(c->empty);
+        TALLY(c, puts, rc);
+        notify(c, &c->notempty);
+        fdsignal(c);
+    }
+
+    return rc;
+}
+
+static int getkind(Channel *c, int n, Message *out)
+{
+    if (c->kind == Cbytes)
         return -1;
+    if (c->kind == Cspsc)
+        return spscget(c, n, out);
+    if (c->kind == Cmpmc)
+        return mpmcget(c, n, out);
+    return lockedget(c, n, out);
+}
+
+/* Non-blocking get of up to n messages for any kind; CLOSED once closed and drained. */
+static int tryget(Channel *c, int n, Message *out)
+{
+    int rc;
+
+    rc = getkind(c, n, out);
+
+    /* puts that happened before the close are visible once closed is, so look once more */
+    if (rc == 0 && isclosed(c))
+    {
+        rc = getkind(c, n, out);
+        if (rc == 0)
+            return CLOSED;
     }
 
-    c->buffer[c->rear] = *in;
-    c->rear = (c->rear + 1) % c->capacity;
+    if (rc > 0)
+    {
+        TALLY(c, gets, rc);
+        notify(c, &c->notfull);
+    }
+    else if (rc == 0)
+        fdrearm(c);
 
-    rc = pthread_mutex_unlock(c->lock);
-    if (rc != 0)
+    return rc;
+}
+
+/* Poll op for a while when the other side tends to answer quickly, then
+ * park on e until a notify or the deadline, which returns 0.  The poll
+ * budget follows the polls that recently paid off, so an idle or
+ * oversubscribed channel decays to parking straight away. */
+static int backoff(Channel *c, Event *e, Op *op, int n, Message *m, struct timespec const *deadline)
+{
+    int rc;
+    int32_t i, spin, limit;
+    uint32_t key;
+
+    spin = __atomic_load_n(&e->spin, __ATOMIC_RELAXED);
+    limit = (2 * spin + 10 < spinmax) ? 2 * spin + 10 : spinmax;
+
+    for (i = 0; i < limit; ++i)
     {
-        sem_post(c->empty);
-        return -1;
+        rc = op(c, n, m);
+        if (rc != 0)
+        {
+            __atomic_store_n(&e->spin, spin + (i - spin) / 8, __ATOMIC_RELAXED);
+            return rc;
+        }
+        cpurelax();
     }
 
-    rc = sem_post(c->full);
-    if (rc == -1)
+    __atomic_store_n(&e->spin, spin - spin / 8, __ATOMIC_RELAXED);
+
+    for (;;)
     {
-        sem_post(c->empty);
-        return -1;
+        key = eventprepare(e);
+        rc = op(c, n, m);
+        if (rc != 0)
+            return rc;
+
+        if (eventwait(e, key, deadline) != 0)
+            return (errno == ETIMEDOUT) ? 0 : -1;
     }
+}
 
-    return 0;
+/* Leave the waiting count; the last caller out wakes a waiting channeldestroy.
+ * Nothing in c is touched after the decrement but the futex address itself. */
+static void leave(Channel *c)
+{
+    if (__atomic_sub_fetch(&c->waiting, 1, __ATOMIC_SEQ_CST) == DESTROYING)
+        futexwake(&c->waiting, INT_MAX, FUTEX_PRIVATE_FLAG);
+}
+
+/* Retry op until it moves something, counting the caller while it waits
+ * so that channeldestroy can wake it and wait for it to leave. */
+static int waitfor(Channel *c, Event *e, Op *op, int n, Message *m, struct timespec const *deadline)
+{
+    int rc;
+#ifdef BITS_STATS
+    uint64_t start;
+#endif
+
+    rc = op(c, n, m);
+    if (rc != 0)
+        return rc;
+
+#ifdef BITS_STATS
+    if (e == &c->notfull)
+        TALLY(c, full, 1);
+    else
+        TALLY(c, empty, 1);
+    start = nanos();
+#endif
+
+    __atomic_fetch_add(&c->waiting, 1, __ATOMIC_SEQ_CST);
+    rc = backoff(c, e, op, n, m, deadline);
+
+#ifdef BITS_STATS
+    if (e == &c->notfull)
+        TALLY(c, putwaitns, nanos() - start);
+    else
+        TALLY(c, getwaitns, nanos() - start);
+#endif
+
+    leave(c);
+    return rc;
+}
+
+/* single-message calls report 0 when the message moved, 1 when it would
+ * block, 2 when the channel is closed and -1 on error */
+static int single(int rc)
+{
+    if (rc == CLOSED)
+        return 2;
+    return (rc < 0) ? -1 : (rc == 0);
+}
+
+/* batch calls report the number moved, 0 when closed and -1 on error */
+static int many(int rc)
+{
+    return (rc == CLOSED) ? 0 : rc;
+}
+
+int channelput(Channel *c, struct Message *in)
+{
+    int rc;
+
+    if (c == NULL || in == NULL)
+        return -1;
+
+    rc = tryput(c, 1, in);
+    if (rc == 0)
+        TALLY(c, full, 1);
+    return single(rc);
+}
+
+int channelputwait(Channel *c, Message *in)
+{
+    if (c == NULL || in == NULL)
+        return -1;
+
+    return single(waitfor(c, &c->notfull, tryput, 1, in, NULL));
+}
+
+int channelputmany(Channel *c, int n, Message *in)
+{
+    if (c == NULL || in == NULL || n <= 0)
+        return -1;
+
+    return many(waitfor(c, &c->notfull, tryput, n, in, NULL));
 }
 
 int channelget(Channel *c, struct Message *out)
+{
+    if (c == NULL || out == NULL)
+        return -1;
+
+    return single(waitfor(c, &c->notempty, tryget, 1, out, NULL));
+}
+
+int channelgettimed(Channel *c, Message *out, struct timespec const *deadline)
+{
+    if (c == NULL || out == NULL)
+        return -1;
+
+    return single(waitfor(c, &c->notempty, tryget, 1, out, deadline));
+}
+
+int channeltryget(Channel *c, Message *out)
 {
     int rc;
 
     if (c == NULL || out == NULL)
         return -1;
 
-    rc = sem_wait(c->full);
-    if (rc == -1)
+    rc = tryget(c, 1, out);
+    if (rc == 0)
+        TALLY(c, empty, 1);
+    return single(rc);
+}
+
+int channelgetmany(Channel *c, int n, Message *out)
+{
+    if (c == NULL || out == NULL || n <= 0)
         return -1;
 
-    rc = pthread_mutex_lock(c->lock);
-    if (rc != 0)
-    {
-        sem_post(c->full);
+    return many(waitfor(c, &c->notempty, tryget, n, out, NULL));
+}
+
+/* Cbytes keeps a ring of records, each a Record and its payload rounded up
+ * to recalign, for one producer and one consumer.  A record never wraps:
+ * when it does not fit before the end, a skip header fills the gap and the
+ * record starts over at offset 0, both published by the same commit.  A
+ * record takes at most half the ring, so that it fits once the ring drains
+ * wherever the gap falls. */
+static Record *record(Channel *c, size_t pos)
+{
+    return (Record *)(records(c) + slot(c, pos));
+}
+
+/* Reserve room for a payload of n bytes after tail, as an Op: 1 when
+ * reserved, 0 when there is no room yet, -1 when there never will be. */
+static int bytesreserve(Channel *c, int n, Message *unused)
+{
+    size_t const tail = c->tail;
+    size_t need, skip;
+
+    (void)unused;
+    if (isclosed(c))
+        return CLOSED;
+
+    need = sizeof(Record) + recround((size_t)n);
+    if (need > c->capacity / 2)
         return -1;
+
+    skip = c->capacity - slot(c, tail);
+    if (skip >= need)
+        skip = 0;
+
+    if (c->capacity - (tail - c->headcache) < skip + need)
+    {
+        c->headcache = __atomic_load_n(&c->head, __ATOMIC_ACQUIRE);
+        if (c->capacity - (tail - c->headcache) < skip + need)
+            return 0;
     }
 
-    *out = c->buffer[c->front];
-    c->front = (c->front + 1) % c->capacity;
+    if (skip > 0)
+        record(c, tail)->size = skipmark;
 
-    rc = pthread_mutex_unlock(c->lock);
-    if (rc != 0)
+    c->skip = skip;
+    c->reserved = skip + need;
+    return 1;
+}
+
+/* Hold the record at head, passing over a skip: 1 when held, 0 when empty. */
+static int bytesacquire(Channel *c)
+{
+    size_t head = c->head;
+
+    if (c->tailcache == head)
     {
-        sem_post(c->full);
-        return -1;
+        c->tailcache = __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE);
+        if (c->tailcache == head)
+            return 0;
     }
 
-    rc = sem_post(c->empty);
-    if (rc == -1)
+    if (record(c, head)->size == skipmark)
     {
-        sem_post(c->full);
-        return -1;
+        head += c->capacity - slot(c, head);
+        __atomic_store_n(&c->head, head, __ATOMIC_RELEASE);
+    }
+
+    c->held = sizeof(Record) + recround(record(c, head)->size);
+    return 1;
+}
+
+/* bytesacquire with tryget's handling of a close */
+static int trybytes(Channel *c, int n, Message *unused)
+{
+    int rc;
+
+    (void)n;
+    (void)unused;
+
+    rc = bytesacquire(c);
+    if (rc == 0 && isclosed(c))
+    {
+        rc = bytesacquire(c);
+        if (rc == 0)
+            return CLOSED;
+    }
+
+    if (rc == 0)
+        fdrearm(c);
+    return rc;
+}
+
+static int reserved(Channel *c, int rc, void **slot)
+{
+    if (rc > 0)
+        *slot = record(c, c->tail + c->skip) + 1;
+    return single(rc);
+}
+
+static int acquired(Channel *c, int rc, void **slot, size_t *size)
+{
+    Record *r;
+
+    if (rc > 0)
+    {
+        r = record(c, c->head);
+        *slot = r + 1;
+        *size = r->size;
     }
+    return single(rc);
+}
+
+int channelreserve(Channel *c, size_t size, void **slot)
+{
+    int rc;
+
+    if (c == NULL || slot == NULL || c->kind != Cbytes || size > maxcapacity)
+        return -1;
 
+    rc = bytesreserve(c, (int)size, NULL);
+    if (rc == 0)
+        TALLY(c, full, 1);
+    return reserved(c, rc, slot);
+}
+
+int channelreservewait(Channel *c, size_t size, void **slot)
+{
+    if (c == NULL || slot == NULL || c->kind != Cbytes || size > maxcapacity)
+        return -1;
+
+    return reserved(c, waitfor(c, &c->notfull, bytesreserve, (int)size, NULL, NULL), slot);
+}
+
+int channelcommit(Channel *c, size_t size)
+{
+    size_t need;
+
+    if (c == NULL || c->kind != Cbytes || c->reserved == 0 || size > maxcapacity)
+        return -1;
+
+    need = sizeof(Record) + recround(size);
+    if (c->skip + need > c->reserved)
+        return -1;
+
+    record(c, c->tail + c->skip)->size = size;
+    __atomic_store_n(&c->tail, c->tail + c->skip + need, __ATOMIC_RELEASE);
+    c->reserved = 0;
+
+    TALLY(c, puts, 1);
+    notify(c, &c->notempty);
+    fdsignal(c);
+    return 0;
+}
+
+int channelacquire(Channel *c, void **slot, size_t *size)
+{
+    if (c == NULL || slot == NULL || size == NULL || c->kind != Cbytes)
+        return -1;
+
+    return acquired(c, waitfor(c, &c->notempty, trybytes, 1, NULL, NULL), slot, size);
+}
+
+int channeltryacquire(Channel *c, void **slot, size_t *size)
+{
+    int rc;
+
+    if (c == NULL || slot == NULL || size == NULL || c->kind != Cbytes)
+        return -1;
+
+    rc = trybytes(c, 1, NULL);
+    if (rc == 0)
+        TALLY(c, empty, 1);
+    return acquired(c, rc, slot, size);
+}
+
+int channelrelease(Channel *c)
+{
+    if (c == NULL || c->kind != Cbytes || c->held == 0)
+        return -1;
+
+    __atomic_store_n(&c->head, c->head + c->held, __ATOMIC_RELEASE);
+    c->held = 0;
+
+    TALLY(c, gets, 1);
+    notify(c, &c->notfull);
     return 0;
 }
 
 int channelsize(Channel *c)
 {
-    int rc, ret;
+    int ret;
+    size_t head;
 
     if (c == NULL)
         return 0;
 
-    rc = sem_getvalue(c->full, &ret);
-    if (rc == -1)
+    /* head first: tail can only have moved further by the time it is read */
+    if (c->kind != Clocked)
+    {
+        head = __atomic_load_n(&c->head, __ATOMIC_ACQUIRE);
+        return (int)(__atomic_load_n(&c->tail, __ATOMIC_ACQUIRE) - head);
+    }
+
+    if (pthread_mutex_lock(&c->lock) != 0)
         return -1;
 
+    ret = (int)c->count;
+
+    (void)pthread_mutex_unlock(&c->lock);
+    return ret;
+}
+
+int channelstats(Channel *c, Channelstats *s)
+{
+    int size;
+#ifdef BITS_STATS
+    size_t i;
+#endif
+
+    if (c == NULL || s == NULL)
+        return -1;
+
+    size = channelsize(c);
+    if (size < 0)
+        return -1;
+
+    memset(s, 0, sizeof(*s));
+    s->capacity = c->capacity;
+    s->size = (size_t)size;
+
+#ifdef BITS_STATS
+    s->puts = __atomic_load_n(&c->stats.puts, __ATOMIC_RELAXED);
+    s->gets = __atomic_load_n(&c->stats.gets, __ATOMIC_RELAXED);
+    s->full = __atomic_load_n(&c->stats.full, __ATOMIC_RELAXED);
+    s->empty = __atomic_load_n(&c->stats.empty, __ATOMIC_RELAXED);
+    s->putwaitns = __atomic_load_n(&c->stats.putwaitns, __ATOMIC_RELAXED);
+    s->getwaitns = __atomic_load_n(&c->stats.getwaitns, __ATOMIC_RELAXED);
+    s->contended = __atomic_load_n(&c->stats.contended, __ATOMIC_RELAXED);
+    for (i = 0; i < NELEM(s->depth); ++i)
+        s->depth[i] = __atomic_load_n(&c->stats.depth[i], __ATOMIC_RELAXED);
+#endif
+
+    return 0;
+}
+
+/* Try each case once from start; fire the first that moves a message or
+ * finds its channel closed and return its index, or -1 when none is ready. */
+static int sweep(Select *s, int n, int start)
+{
+    int i, j, rc;
+
+    for (j = 0; j < n; ++j)
+    {
+        i = (start + j) % n;
+        rc = (s[i].op == Sget) ? tryget(s[i].c, 1, s[i].m) : tryput(s[i].c, 1, s[i].m);
+        if (rc != 0)
+        {
+            s[i].rc = single(rc);
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+int channelselect(Select *s, int n, struct timespec const *deadline)
+{
+    int i, start, ret;
+    uint32_t key;
+
+    if (s == NULL || n <= 0)
+        goto invalid;
+
+    for (i = 0; i < n; ++i)
+    {
+        if (s[i].c == NULL || s[i].m == NULL || (s[i].op != Sget && s[i].op != Sput) || s[i].c->magic == shmmagic ||
+            s[i].c->kind == Cbytes)
+            goto invalid;
+    }
+
+    start = (int)(__atomic_fetch_add(&rotor, 1U, __ATOMIC_RELAXED) % (unsigned)n);
+
+    ret = sweep(s, n, start);
+    if (ret >= 0)
+        return ret;
+
+    /* announce the selector on every channel before the re-check, so a
+     * put or get either is seen by the sweep or sees selecting */
+    for (i = 0; i < n; ++i)
+    {
+        __atomic_fetch_add(&s[i].c->waiting, 1, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&s[i].c->selecting, 1, __ATOMIC_SEQ_CST);
+    }
+
+    for (;;)
+    {
+        key = eventprepare(&selectors);
+        ret = sweep(s, n, start);
+        if (ret >= 0)
+            break;
+
+        if (eventwait(&selectors, key, deadline) != 0)
+            break;
+    }
+
+    for (i = 0; i < n; ++i)
+    {
+        __atomic_fetch_sub(&s[i].c->selecting, 1, __ATOMIC_SEQ_CST);
+        leave(s[i].c);
+    }
+
     return ret;
+
+invalid:
+    errno = EINVAL;
+    return -1;
 }
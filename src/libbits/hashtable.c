@@ -1,10 +1,18 @@
 #include <assert.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "bits.h"
 #include "macro.h"
 #include "printf.h"
 
+#ifdef BITS_STATS
+#    define TALLY(t, field, n) ((void)__atomic_fetch_add(&(t)->field, (uint64_t)(n), __ATOMIC_RELAXED))
+#else
+#    define TALLY(t, field, n) ((void)0)
+#endif
+
 typedef struct Entry Entry;
 
 struct Entry
@@ -18,6 +26,15 @@ struct Entry
 struct Table
 {
     size_t len;
+    Entry *nodes;    /**< chain nodes allocated by tablebuild */
+    size_t nodeslen; /**< number of entries in nodes */
+    char *keys;      /**< key storage allocated by tablebuild */
+    size_t keyslen;  /**< size of keys in bytes */
+#ifdef BITS_STATS
+    uint64_t lookups;
+    uint64_t misses;
+    uint64_t probes;
+#endif
     Entry columns[1]; /* C89 flexible array member workaround */
 };
 
@@ -39,6 +56,32 @@ Table *tablecreate(size_t const len)
     return ret;
 }
 
+static int ownsnode(Table const *t, Entry const *e)
+{
+    uintptr_t const p = (uintptr_t)e, base = (uintptr_t)t->nodes;
+
+    return t->nodes != NULL && p >= base && p < base + t->nodeslen * sizeof(*e);
+}
+
+static int ownskey(Table const *t, char const *key)
+{
+    uintptr_t const p = (uintptr_t)key, base = (uintptr_t)t->keys;
+
+    return t->keys != NULL && p >= base && p < base + t->keyslen;
+}
+
+static void freenode(Table *t, Entry *e)
+{
+    if (!ownsnode(t, e))
+        free(e);
+}
+
+static void freekey(Table *t, char const *key)
+{
+    if (!ownskey(t, key))
+        free((char *)key);
+}
+
 void tabledestroy(Table *t, void finalize(void *))
 {
     size_t i;
@@ -56,27 +99,32 @@ void tabledestroy(Table *t, void finalize(void *))
             if (finalize != NULL && curr->value != NULL)
                 finalize(curr->value);
 
-            free((char *)curr->key);
-            free(curr);
+            freekey(t, curr->key);
+            freenode(t, curr);
             curr = next;
         }
 
         if (finalize != NULL && t->columns[i].value != NULL)
             finalize(t->columns[i].value);
         if (t->columns[i].key != NULL)
-            free((char *)t->columns[i].key);
+            freekey(t, t->columns[i].key);
     }
+    free(t->nodes);
+    free(t->keys);
     free(t);
 }
 
-static uint64_t getindex(size_t const len, char const *key)
+/* Keys are hashed with their terminating NUL. */
+static uint64_t keyhash(char const *key)
 {
-    uint64_t hash;
+    assert(key != NULL);
+    return fnv(strlen(key) + 1, (unsigned char const *)key);
+}
 
+static uint64_t getindex(size_t const len, char const *key)
+{
     assert(ISPOW2(len));
-    assert(key != NULL);
-    hash = fnv(strlen(key) + 1, (unsigned char const *)key);
-    return hash & (uint64_t)(len - 1);
+    return keyhash(key) & (uint64_t)(len - 1);
 }
 
 int tableput(Table *t, char const *key, void *value)
@@ -111,7 +159,7 @@ int tableput(Table *t, char const *key, void *value)
     if (curr != NULL)
     {
         if (curr->deleted && curr->key != NULL)
-            free((char *)curr->key);
+            freekey(t, curr->key);
         curr->key = strdup(key);
         if (curr->key == NULL)
             return -1;
@@ -141,6 +189,17 @@ int tableput(Table *t, char const *key, void *value)
 }
 
 void *tableget(Table *t, char const *key)
+{
+    if (t == NULL)
+        return NULL;
+
+    if (key == NULL)
+        return NULL;
+
+    return tablegethash(t, keyhash(key), key);
+}
+
+void *tablegethash(Table *t, uint64_t const hash, char const *key)
 {
     uint64_t i;
     Entry *curr;
@@ -151,16 +210,25 @@ void *tableget(Table *t, char const *key)
     if (key == NULL)
         return NULL;
 
-    i = getindex(t->len, key);
+    i = hash & (uint64_t)(t->len - 1);
     debugprintf("key: %s index: %d\n", key, i);
     curr = &t->columns[i];
 
     while (curr != NULL && (curr->key == NULL || curr->deleted || strcmp(key, curr->key) != 0))
+    {
+        TALLY(t, probes, 1);
         curr = curr->next;
+    }
+
+    TALLY(t, lookups, 1);
 
     if (curr == NULL)
+    {
+        TALLY(t, misses, 1);
         return NULL;
+    }
 
+    TALLY(t, probes, 1);
     return curr->value;
 }
 
@@ -189,7 +257,7 @@ int tabledel(Table *t, char const *key, void finalize(void *))
     if (curr->value != NULL && finalize != NULL)
         finalize(curr->value);
 
-    free((char *)curr->key);
+    freekey(t, curr->key);
     curr->key = NULL;
     curr->value = NULL;
     curr->deleted = 1;
@@ -237,7 +305,7 @@ void tablecompact(Table *t)
             if (curr->deleted)
             {
                 prev->next = next;
-                free(curr);
+                freenode(t, curr);
             }
             else
             {
@@ -247,3 +315,573 @@ void tablecompact(Table *t)
         }
     }
 }
+
+struct Hashjob
+{
+    size_t len;
+    char const *const *keys;
+    uint64_t *hashes;
+    size_t bytes;
+};
+
+static size_t const parallelmin = 1 << 16;
+static long const maxjobs = 64;
+
+static void *hashrange(void *data)
+{
+    struct Hashjob *job = data;
+    size_t i, len;
+
+    for (i = 0; i < job->len; ++i)
+    {
+        len = strlen(job->keys[i]) + 1;
+        job->hashes[i] = fnv(len, (unsigned char const *)job->keys[i]);
+        job->bytes += len;
+    }
+
+    return NULL;
+}
+
+/* Hash n keys into hashes, returning the bytes needed to store them. */
+static size_t hashkeys(size_t const n, char const *const *keys, uint64_t *hashes, int const flags)
+{
+    struct Hashjob job, *jobs;
+    pthread_t *tids;
+    size_t njobs = 1, per, i, bytes = 0;
+    long nprocs;
+
+    if ((flags & Bparallel) && n >= parallelmin)
+    {
+        nprocs = sysconf(_SC_NPROCESSORS_ONLN);
+        if (nprocs > maxjobs)
+            nprocs = maxjobs;
+        if (nprocs > 1)
+            njobs = (size_t)nprocs;
+    }
+
+    jobs = (njobs > 1) ? calloc(njobs, sizeof(*jobs)) : NULL;
+    tids = (njobs > 1) ? calloc(njobs, sizeof(*tids)) : NULL;
+    if (jobs == NULL || tids == NULL)
+    {
+        free(jobs);
+        free(tids);
+
+        job.len = n;
+        job.keys = keys;
+        job.hashes = hashes;
+        job.bytes = 0;
+        (void)hashrange(&job);
+        return job.bytes;
+    }
+
+    per = (n + njobs - 1) / njobs;
+    for (i = 0; i < njobs; ++i)
+    {
+        jobs[i].keys = keys + i * per;
+        jobs[i].hashes = hashes + i * per;
+        jobs[i].len = (i * per < n) ? n - i * per : 0;
+        if (jobs[i].len > per)
+            jobs[i].len = per;
+    }
+
+    /* the calling thread takes the first range, and any range whose thread fails to start */
+    for (i = 1; i < njobs; ++i)
+        if (pthread_create(&tids[i], NULL, hashrange, &jobs[i]) != 0)
+            jobs[i].keys = NULL;
+
+    (void)hashrange(&jobs[0]);
+
+    for (i = 1; i < njobs; ++i)
+    {
+        if (jobs[i].keys != NULL)
+        {
+            (void)pthread_join(tids[i], NULL);
+            continue;
+        }
+
+        jobs[i].keys = keys + i * per;
+        (void)hashrange(&jobs[i]);
+    }
+
+    for (i = 0; i < njobs; ++i)
+        bytes += jobs[i].bytes;
+
+    free(jobs);
+    free(tids);
+    return bytes;
+}
+
+static Entry *findentry(Entry *e, char const *key)
+{
+    for (; e != NULL && e->key != NULL; e = e->next)
+        if (strcmp(key, e->key) == 0)
+            return e;
+
+    return NULL;
+}
+
+Table *tablebuild(size_t const n, char const *const *keys, void *const *values, int const flags)
+{
+    Table *t;
+    uint64_t *hashes;
+    size_t *order, *start;
+    size_t len, i, j, c, begin, nnodes, keylen;
+    Entry *e, *tail;
+    char *kp;
+
+    if (n == 0 || keys == NULL || values == NULL)
+        return NULL;
+
+    for (i = 0; i < n; ++i)
+        if (keys[i] == NULL || values[i] == NULL)
+            return NULL;
+
+    for (len = 1; len < n; len <<= 1)
+        ;
+
+    t = tablecreate(len);
+    hashes = malloc(n * sizeof(*hashes));
+    order = malloc(n * sizeof(*order));
+    start = calloc(len + 1, sizeof(*start));
+    if (t == NULL || hashes == NULL || order == NULL || start == NULL)
+        goto fail;
+
+    t->keyslen = hashkeys(n, keys, hashes, flags);
+    t->keys = malloc(t->keyslen);
+    if (t->keys == NULL)
+        goto fail;
+
+    /* stable counting sort of the keys by column, so each chain is laid out contiguously */
+    for (i = 0; i < n; ++i)
+        start[(hashes[i] & (len - 1)) + 1] += 1;
+
+    for (c = 0, nnodes = 0; c < len; ++c)
+    {
+        if (start[c + 1] > 1)
+            nnodes += start[c + 1] - 1;
+        start[c + 1] += start[c];
+    }
+
+    for (i = 0; i < n; ++i)
+        order[start[hashes[i] & (len - 1)]++] = i;
+
+    if (nnodes > 0)
+    {
+        t->nodes = calloc(nnodes, sizeof(*t->nodes));
+        if (t->nodes == NULL)
+            goto fail;
+        t->nodeslen = nnodes;
+    }
+
+    kp = t->keys;
+    nnodes = 0;
+    for (c = 0, begin = 0; c < len; begin = start[c++])
+    {
+        tail = NULL;
+        for (j = begin; j < start[c]; ++j)
+        {
+            i = order[j];
+
+            if (!(flags & Bunique) && (e = findentry(&t->columns[c], keys[i])) != NULL)
+            {
+                e->value = values[i];
+                continue;
+            }
+
+            e = (tail == NULL) ? &t->columns[c] : &t->nodes[nnodes++];
+            keylen = strlen(keys[i]) + 1;
+            memcpy(kp, keys[i], keylen);
+            e->key = kp;
+            e->value = values[i];
+            kp += keylen;
+
+            if (tail != NULL)
+                tail->next = e;
+            tail = e;
+        }
+    }
+
+    free(hashes);
+    free(order);
+    free(start);
+    return t;
+
+fail:
+    free(hashes);
+    free(order);
+    free(start);
+    tabledestroy(t, NULL);
+    return NULL;
+}
+
+int tablestats(Table *t, Tablestats *s)
+{
+    size_t i, n;
+    Entry *curr;
+
+    if (t == NULL || s == NULL)
+        return -1;
+
+    memset(s, 0, sizeof(*s));
+    s->columns = t->len;
+
+    for (i = 0; i < t->len; ++i)
+    {
+        n = 0;
+        for (curr = &t->columns[i]; curr != NULL; curr = curr->next)
+        {
+            if (curr != &t->columns[i])
+            {
+                s->nodes += 1;
+                s->nodebytes += sizeof(*curr);
+            }
+            else if (curr->key == NULL && !curr->deleted)
+            {
+                /* unused embedded entry */
+                continue;
+            }
+
+            n += 1;
+            if (curr->deleted)
+            {
+                s->deleted += 1;
+                continue;
+            }
+
+            s->live += 1;
+            s->keybytes += strlen(curr->key) + 1;
+        }
+
+        if (n > s->maxchain)
+            s->maxchain = n;
+        s->chains[(n < NELEM(s->chains)) ? n : NELEM(s->chains) - 1] += 1;
+    }
+
+#ifdef BITS_STATS
+    s->lookups = __atomic_load_n(&t->lookups, __ATOMIC_RELAXED);
+    s->misses = __atomic_load_n(&t->misses, __ATOMIC_RELAXED);
+    s->probes = __atomic_load_n(&t->probes, __ATOMIC_RELAXED);
+#endif
+
+    return 0;
+}
+
+/*
+ * Frozen tables map their keys through a minimal perfect hash built by
+ * fingerprint cascading (BBHash with gamma = 1).  Each level is a bitset
+ * with one bit per key still to be placed; a key whose position at a
+ * level is not shared with another key sets that bit, the rest fall
+ * through to the next level.  A key's slot is the rank of its bit across
+ * all levels, so a lookup hashes once, walks the levels until it finds a
+ * set bit, and probes exactly one slot.  The levels take about e bits per
+ * key and the rank samples a sixteenth of that again.
+ */
+
+#define MAXLEVELS 48
+
+static size_t const blockwords = 8; /**< words per rank sample */
+
+struct Slot
+{
+    char const *key;
+    void *value;
+};
+
+struct Frozen
+{
+    size_t len;                    /**< number of keys placed in slots */
+    size_t nlevels;                /**< number of levels in use */
+    size_t offsets[MAXLEVELS + 1]; /**< first bit of each level, then the end */
+    uint64_t *bits;                /**< bitsets of all levels */
+    uint32_t *ranks;               /**< set bits before each block of bits */
+    struct Slot *slots;            /**< entries in hash order */
+    char *keyblob;                 /**< storage for keys */
+    Table *spill;                  /**< keys not placed by the last level */
+};
+
+static uint64_t mixlevel(uint64_t x, size_t const level)
+{
+    /* splitmix64 finalizer */
+    x += (uint64_t)(level + 1) * 0x9e3779b97f4a7c15;
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111eb;
+    x ^= x >> 31;
+    return x;
+}
+
+/* Map a hash onto [0, nbits) with a multiply and shift instead of a division. */
+static size_t reduce(uint64_t const x, size_t const nbits)
+{
+    assert(nbits <= UINT32_MAX);
+    return (size_t)(((x >> 32) * (uint64_t)nbits) >> 32);
+}
+
+static size_t levelpos(Frozen const *f, uint64_t const hash, size_t const level)
+{
+    return f->offsets[level] + reduce(mixlevel(hash, level), f->offsets[level + 1] - f->offsets[level]);
+}
+
+static int testbit(uint64_t const *bits, size_t const pos)
+{
+    return (bits[pos / 64] >> (pos % 64)) & 1;
+}
+
+static void setbit(uint64_t *bits, size_t const pos)
+{
+    bits[pos / 64] |= (uint64_t)1 << (pos % 64);
+}
+
+static size_t rank(Frozen const *f, size_t const pos)
+{
+    size_t const word = pos / 64, block = word / blockwords;
+    size_t i, ret = f->ranks[block];
+
+    for (i = block * blockwords; i < word; ++i)
+        ret += (size_t)__builtin_popcountll(f->bits[i]);
+
+    return ret + (size_t)__builtin_popcountll(f->bits[word] & (((uint64_t)1 << (pos % 64)) - 1));
+}
+
+/* Find the slot of a key with the given hash, or return f->len if it has none. */
+static size_t slot(Frozen const *f, uint64_t const hash)
+{
+    size_t level, pos;
+
+    for (level = 0; level < f->nlevels; ++level)
+    {
+        pos = levelpos(f, hash, level);
+        if (testbit(f->bits, pos))
+            return rank(f, pos);
+    }
+
+    return f->len;
+}
+
+/* Collect the live entries of t, returning how many there are. */
+static size_t collect(Table *t, Entry **entries)
+{
+    size_t i, n = 0;
+    Entry *curr;
+
+    for (i = 0; i < t->len; ++i)
+        for (curr = &t->columns[i]; curr != NULL; curr = curr->next)
+            if (curr->key != NULL && !curr->deleted)
+            {
+                if (entries != NULL)
+                    entries[n] = curr;
+                n += 1;
+            }
+
+    return n;
+}
+
+/*
+ * Place the keys whose hashes are in pending[0..n) into at most maxlevels
+ * successive levels, returning how many keys were left over.  Leftovers are
+ * moved to the front of pending.
+ */
+static size_t cascade(Frozen *f, uint64_t *pending, size_t n, size_t maxlevels)
+{
+    size_t level, nbits, i, pos, left, words = 0;
+    uint64_t *seen = NULL, *coll = NULL, *grown;
+
+    f->offsets[0] = 0;
+
+    for (level = 0; level < maxlevels && n > 0; ++level)
+    {
+        nbits = (n + 63) & ~(size_t)63;
+        f->offsets[level + 1] = f->offsets[level] + nbits;
+
+        grown = realloc(f->bits, (f->offsets[level + 1] / 64) * sizeof(*grown));
+        free(seen);
+        free(coll);
+        seen = calloc(nbits / 64, sizeof(*seen));
+        coll = calloc(nbits / 64, sizeof(*coll));
+        if (grown == NULL || seen == NULL || coll == NULL)
+        {
+            if (grown != NULL)
+                f->bits = grown;
+            n = (size_t)-1;
+            break;
+        }
+        f->bits = grown;
+        f->nlevels = level + 1;
+
+        for (i = 0; i < n; ++i)
+        {
+            pos = reduce(mixlevel(pending[i], level), nbits);
+            if (testbit(seen, pos))
+                setbit(coll, pos);
+            else
+                setbit(seen, pos);
+        }
+
+        for (i = 0; i < nbits / 64; ++i)
+            f->bits[words + i] = seen[i] & ~coll[i];
+        words += nbits / 64;
+
+        for (i = 0, left = 0; i < n; ++i)
+        {
+            pos = reduce(mixlevel(pending[i], level), nbits);
+            if (testbit(coll, pos))
+                pending[left++] = pending[i];
+        }
+        n = left;
+    }
+
+    free(seen);
+    free(coll);
+    return n;
+}
+
+static int buildranks(Frozen *f)
+{
+    size_t const words = f->offsets[f->nlevels] / 64;
+    size_t const nblocks = words / blockwords + 1;
+    size_t i, total = 0;
+
+    f->ranks = calloc(nblocks, sizeof(*f->ranks));
+    if (f->ranks == NULL)
+        return -1;
+
+    for (i = 0; i < words; ++i)
+    {
+        if (i % blockwords == 0)
+            f->ranks[i / blockwords] = (uint32_t)total;
+        total += (size_t)__builtin_popcountll(f->bits[i]);
+    }
+
+    if (words % blockwords == 0)
+        f->ranks[words / blockwords] = (uint32_t)total;
+
+    return 0;
+}
+
+/*
+ * tablefreeze with at most maxlevels levels.  Not in bits.h: the tests use
+ * it to send keys to the spill table, which the full cascade never does.
+ */
+Frozen *tablefreezelevels(Table *t, size_t maxlevels)
+{
+    Frozen *f;
+    Entry **entries = NULL;
+    uint64_t *hashes = NULL, *pending = NULL;
+    size_t n, i, s, left, len, bytes = 0, keylen;
+    char *kp;
+
+    if (t == NULL)
+        return NULL;
+
+    f = calloc(1, sizeof(*f));
+    if (f == NULL)
+        return NULL;
+
+    n = collect(t, NULL);
+    entries = malloc((n + 1) * sizeof(*entries));
+    hashes = malloc((n + 1) * sizeof(*hashes));
+    pending = malloc((n + 1) * sizeof(*pending));
+    if (entries == NULL || hashes == NULL || pending == NULL)
+        goto fail;
+
+    (void)collect(t, entries);
+    for (i = 0; i < n; ++i)
+    {
+        hashes[i] = pending[i] = keyhash(entries[i]->key);
+        bytes += strlen(entries[i]->key) + 1;
+    }
+
+    left = cascade(f, pending, n, (maxlevels < MAXLEVELS) ? maxlevels : MAXLEVELS);
+    if (left == (size_t)-1)
+        goto fail;
+
+    f->len = n - left;
+    if (f->nlevels > 0 && buildranks(f) != 0)
+        goto fail;
+
+    f->slots = calloc(f->len + 1, sizeof(*f->slots));
+    f->keyblob = malloc(bytes + 1);
+    if (f->slots == NULL || f->keyblob == NULL)
+        goto fail;
+
+    if (left > 0)
+    {
+        /* a column per leftover key, as tablebuild sizes its tables */
+        for (len = 1; len < left; len <<= 1)
+            ;
+        f->spill = tablecreate(len);
+        if (f->spill == NULL)
+            goto fail;
+    }
+
+    kp = f->keyblob;
+    for (i = 0; i < n; ++i)
+    {
+        s = slot(f, hashes[i]);
+        if (s == f->len)
+        {
+            if (tableput(f->spill, entries[i]->key, entries[i]->value) != 0)
+                goto fail;
+            continue;
+        }
+
+        keylen = strlen(entries[i]->key) + 1;
+        memcpy(kp, entries[i]->key, keylen);
+        f->slots[s].key = kp;
+        f->slots[s].value = entries[i]->value;
+        kp += keylen;
+    }
+
+    free(entries);
+    free(hashes);
+    free(pending);
+    return f;
+
+fail:
+    free(entries);
+    free(hashes);
+    free(pending);
+    frozendestroy(f);
+    return NULL;
+}
+
+Frozen *tablefreeze(Table *t)
+{
+    return tablefreezelevels(t, MAXLEVELS);
+}
+
+void *frozenget(Frozen *f, char const *key)
+{
+    if (f == NULL || key == NULL)
+        return NULL;
+
+    return frozengethash(f, keyhash(key), key);
+}
+
+void *frozengethash(Frozen *f, uint64_t const hash, char const *key)
+{
+    size_t s;
+
+    if (f == NULL || key == NULL)
+        return NULL;
+
+    s = slot(f, hash);
+    if (s < f->len)
+        return (strcmp(key, f->slots[s].key) == 0) ? f->slots[s].value : NULL;
+
+    return (f->spill != NULL) ? tablegethash(f->spill, hash, key) : NULL;
+}
+
+void frozendestroy(Frozen *f)
+{
+    if (f == NULL)
+        return;
+
+    tabledestroy(f->spill, NULL);
+    free(f->bits);
+    free(f->ranks);
+    free(f->slots);
+    free(f->keyblob);
+    free(f);
+}
@@ -0,0 +1,449 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bits.h"
+
+#define CACHELINE 64
+
+typedef struct Item Item;
+typedef struct Stage Stage;
+typedef struct Worker Worker;
+
+/* A message in flight.  Channels inside the pipeline carry pointers to
+ * items, so that the input sequence number travels with the message. */
+struct Item
+{
+    uint64_t seq;
+    int dropped; /**< Refused by a stage; later stages pass it through untouched */
+    Message m;
+};
+
+/* Counters are stored only by the owning worker and loaded by pipelinestats. */
+struct Worker
+{
+    uint64_t items;
+    uint64_t busyns;
+    uint64_t idlens;
+    uint64_t blockedns;
+    uint64_t stopns; /**< When the worker returned, 0 while it runs */
+    char pad[CACHELINE - 5 * sizeof(uint64_t)];
+    Stage *stage;
+    pthread_t tid;
+};
+
+struct Stage
+{
+    Pipeline *pipeline;
+    char const *name;
+    int (*fn)(void *, Message *);
+    void *arg;
+    int nworkers;
+    int ordered;
+    int passdropped; /**< An ordered stage follows and needs every sequence number */
+    int started;     /**< Worker threads created */
+    int running;     /**< Workers not yet returned; the last closes out */
+    Channel *in;
+    Channel *out;
+    Worker *workers;
+
+    pthread_mutex_t lock; /**< Ordered stages: protects slots and next */
+    Item **slots;         /**< Finished items waiting for their turn, by seq % nitems */
+    uint64_t next;        /**< Sequence number to emit next */
+};
+
+struct Pipeline
+{
+    size_t capacity;
+    Stage *stages;
+    int nstages;
+    int started;
+
+    Channel **chans; /**< nstages + 1: stage i reads chans[i] and writes chans[i + 1] */
+    Channel *free;   /**< Unused items; running out is what blocks pipelineput */
+    Item *items;
+    size_t nitems;
+    uint64_t seq;
+    uint64_t startns;
+
+    int ordered;             /**< Some stage is ordered: sequence numbers may have no gaps */
+    pthread_mutex_t putlock; /**< Ordered pipelines: claiming seq and the put are one step */
+};
+
+static uint64_t nanos(void)
+{
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+}
+
+static void release(Pipeline *p, Item *it)
+{
+    Message m;
+
+    m.tag = Tsome;
+    m.value = (intptr_t)it;
+    (void)channelput(p->free, &m);
+}
+
+/* Pass an item downstream, or straight back to the free list once dropped
+ * if nothing downstream needs to see it. */
+static int emit(Stage *s, Item *it)
+{
+    Message m;
+
+    if (it->dropped && !s->passdropped)
+    {
+        release(s->pipeline, it);
+        return 0;
+    }
+
+    m.tag = Tsome;
+    m.value = (intptr_t)it;
+    return channelputwait(s->out, &m);
+}
+
+/* Park a finished item and emit every item whose turn has come, in input order. */
+static int reorder(Stage *s, Item *it)
+{
+    size_t n = s->pipeline->nitems;
+    int rc = 0;
+
+    (void)pthread_mutex_lock(&s->lock);
+
+    s->slots[it->seq % n] = it;
+    while (rc == 0 && (it = s->slots[s->next % n]) != NULL)
+    {
+        s->slots[s->next % n] = NULL;
+        s->next += 1;
+        rc = emit(s, it);
+    }
+
+    (void)pthread_mutex_unlock(&s->lock);
+    return rc;
+}
+
+static void *work(void *data)
+{
+    Worker *w = data;
+    Stage *s = w->stage;
+    Item *it;
+    Message m;
+    uint64_t t0, t1, t2, t3;
+    int rc;
+
+    t0 = nanos();
+    while (channelget(s->in, &m) == 0)
+    {
+        t1 = nanos();
+        it = (Item *)m.value;
+        if (!it->dropped && s->fn(s->arg, &it->m) != 0)
+            it->dropped = 1;
+
+        t2 = nanos();
+        rc = s->ordered ? reorder(s, it) : emit(s, it);
+        t3 = nanos();
+
+        __atomic_store_n(&w->items, w->items + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&w->idlens, w->idlens + (t1 - t0), __ATOMIC_RELAXED);
+        __atomic_store_n(&w->busyns, w->busyns + (t2 - t1), __ATOMIC_RELAXED);
+        __atomic_store_n(&w->blockedns, w->blockedns + (t3 - t2), __ATOMIC_RELAXED);
+        if (rc != 0)
+            break;
+
+        t0 = t3;
+    }
+
+    __atomic_store_n(&w->stopns, nanos(), __ATOMIC_RELAXED);
+    if (__atomic_sub_fetch(&s->running, 1, __ATOMIC_ACQ_REL) == 0)
+        channelclose(s->out);
+
+    return NULL;
+}
+
+Pipeline *pipelinecreate(size_t capacity)
+{
+    Pipeline *p;
+
+    if (capacity == 0)
+        return NULL;
+
+    p = calloc(1, sizeof(*p));
+    if (p == NULL)
+        return NULL;
+
+    if (pthread_mutex_init(&p->putlock, NULL) != 0)
+    {
+        free(p);
+        return NULL;
+    }
+
+    p->capacity = capacity;
+    return p;
+}
+
+int pipelinestage(Pipeline *p, char const *name, int fn(void *, Message *), void *arg, int nworkers, int ordered)
+{
+    Stage *stages, *s;
+
+    if (p == NULL || p->started || fn == NULL || nworkers < 1)
+        return -1;
+
+    stages = realloc(p->stages, (size_t)(p->nstages + 1) * sizeof(*stages));
+    if (stages == NULL)
+        return -1;
+
+    p->stages = stages;
+    s = &stages[p->nstages];
+    memset(s, 0, sizeof(*s));
+    s->name = name;
+    s->fn = fn;
+    s->arg = arg;
+    s->nworkers = nworkers;
+    s->ordered = (ordered != 0);
+    return p->nstages++;
+}
+
+/* Channel kind for chans[i]: a lock-free ring when one worker sits on each
+ * side, the multi-producer queue otherwise and at the caller's ends. */
+static int chankind(Pipeline *p, int i)
+{
+    if (i > 0 && i < p->nstages && p->stages[i - 1].nworkers == 1 && p->stages[i].nworkers == 1)
+        return Cspsc;
+    return Cmpmc;
+}
+
+int pipelinestart(Pipeline *p)
+{
+    int i, ordered = 0;
+    size_t k;
+    Stage *s;
+
+    if (p == NULL || p->started)
+        return -1;
+
+    /* enough items to fill every channel and keep every worker busy; the
+     * free list and each reorder ring hold them all */
+    p->nitems = p->capacity * (size_t)(p->nstages + 1) + 1;
+    for (i = 0; i < p->nstages; ++i)
+        p->nitems += (size_t)p->stages[i].nworkers;
+
+    p->chans = calloc((size_t)p->nstages + 1, sizeof(*p->chans));
+    p->items = calloc(p->nitems, sizeof(*p->items));
+    p->free = channelcreatekind(p->nitems, Cmpmc);
+    if (p->chans == NULL || p->items == NULL || p->free == NULL)
+        return -1;
+
+    for (k = 0; k < p->nitems; ++k)
+        release(p, &p->items[k]);
+
+    for (i = 0; i <= p->nstages; ++i)
+    {
+        p->chans[i] = channelcreatekind(p->capacity, chankind(p, i));
+        if (p->chans[i] == NULL)
+            return -1;
+    }
+
+    for (i = p->nstages - 1; i >= 0; --i)
+    {
+        s = &p->stages[i];
+        s->pipeline = p;
+        s->passdropped = ordered;
+        s->in = p->chans[i];
+        s->out = p->chans[i + 1];
+        s->workers = calloc((size_t)s->nworkers, sizeof(*s->workers));
+        if (s->workers == NULL)
+            return -1;
+
+        if (s->ordered)
+        {
+            s->slots = calloc(p->nitems, sizeof(*s->slots));
+            if (s->slots == NULL)
+                return -1;
+            if (pthread_mutex_init(&s->lock, NULL) != 0)
+            {
+                free(s->slots);
+                s->slots = NULL;
+                return -1;
+            }
+            ordered = 1;
+        }
+    }
+
+    p->ordered = ordered;
+    p->startns = nanos();
+    p->started = 1;
+
+    for (i = 0; i < p->nstages; ++i)
+    {
+        s = &p->stages[i];
+        s->running = s->nworkers;
+        for (; s->started < s->nworkers; ++s->started)
+        {
+            s->workers[s->started].stage = s;
+            if (pthread_create(&s->workers[s->started].tid, NULL, work, &s->workers[s->started]) != 0)
+                goto unwind;
+        }
+    }
+
+    return 0;
+
+unwind:
+    /* make the workers already running return; pipelinedestroy joins them */
+    for (i = 0; i <= p->nstages; ++i)
+        channelclose(p->chans[i]);
+    return -1;
+}
+
+int pipelineput(Pipeline *p, Message *in)
+{
+    int rc;
+    Item *it;
+    Message m;
+
+    if (p == NULL || in == NULL || !p->started)
+        return -1;
+
+    rc = channelget(p->free, &m);
+    if (rc != 0)
+        return rc;
+
+    it = (Item *)m.value;
+    it->dropped = 0;
+    it->m = *in;
+
+    if (p->ordered)
+    {
+        /* a put that fails after another caller's later seq got through
+         * would leave an ordered stage waiting for the gap forever */
+        (void)pthread_mutex_lock(&p->putlock);
+        it->seq = p->seq;
+        rc = channelputwait(p->chans[0], &m);
+        if (rc == 0)
+            p->seq += 1;
+        (void)pthread_mutex_unlock(&p->putlock);
+    }
+    else
+    {
+        it->seq = __atomic_fetch_add(&p->seq, 1, __ATOMIC_RELAXED);
+        rc = channelputwait(p->chans[0], &m);
+    }
+
+    if (rc != 0)
+        release(p, it);
+    return rc;
+}
+
+int pipelineget(Pipeline *p, Message *out)
+{
+    int rc, dropped;
+    Item *it;
+    Message m;
+
+    if (p == NULL || out == NULL || !p->started)
+        return -1;
+
+    while ((rc = channelget(p->chans[p->nstages], &m)) == 0)
+    {
+        it = (Item *)m.value;
+        dropped = it->dropped;
+        if (!dropped)
+            *out = it->m;
+        release(p, it);
+        if (!dropped)
+            break;
+    }
+
+    return rc;
+}
+
+void pipelineclose(Pipeline *p)
+{
+    if (p != NULL && p->started)
+        channelclose(p->chans[0]);
+}
+
+int pipelinestats(Pipeline *p, int stage, Stagestats *out)
+{
+    int j;
+    uint64_t now, stop;
+    Stage *s;
+    Worker *w;
+
+    if (p == NULL || out == NULL || stage < 0 || stage >= p->nstages)
+        return -1;
+
+    s = &p->stages[stage];
+    out->name = s->name;
+    out->nworkers = s->nworkers;
+    out->items = 0;
+    out->busyns = 0;
+    out->idlens = 0;
+    out->blockedns = 0;
+    out->elapsedns = 0;
+
+    if (!p->started || s->workers == NULL)
+        return 0;
+
+    now = nanos();
+    for (j = 0; j < s->nworkers; ++j)
+    {
+        w = &s->workers[j];
+        out->items += __atomic_load_n(&w->items, __ATOMIC_RELAXED);
+        out->busyns += __atomic_load_n(&w->busyns, __ATOMIC_RELAXED);
+        out->idlens += __atomic_load_n(&w->idlens, __ATOMIC_RELAXED);
+        out->blockedns += __atomic_load_n(&w->blockedns, __ATOMIC_RELAXED);
+        stop = __atomic_load_n(&w->stopns, __ATOMIC_RELAXED);
+        out->elapsedns += ((stop != 0) ? stop : now) - p->startns;
+    }
+
+    return 0;
+}
+
+void pipelinedestroy(Pipeline *p)
+{
+    int i, j;
+    Stage *s;
+
+    if (p == NULL)
+        return;
+
+    /* close everything so that no worker stays blocked */
+    for (i = 0; p->chans != NULL && i <= p->nstages; ++i)
+    {
+        if (p->chans[i] != NULL)
+            channelclose(p->chans[i]);
+    }
+    if (p->free != NULL)
+        channelclose(p->free);
+
+    for (i = 0; i < p->nstages; ++i)
+    {
+        s = &p->stages[i];
+        for (j = 0; j < s->started; ++j)
+            (void)pthread_join(s->workers[j].tid, NULL);
+    }
+
+    for (i = 0; i < p->nstages; ++i)
+    {
+        s = &p->stages[i];
+        if (s->slots != NULL)
+        {
+            (void)pthread_mutex_destroy(&s->lock);
+            free(s->slots);
+        }
+        free(s->workers);
+    }
+
+    for (i = 0; p->chans != NULL && i <= p->nstages; ++i)
+        channeldestroy(p->chans[i]);
+
+    channeldestroy(p->free);
+    (void)pthread_mutex_destroy(&p->putlock);
+    free(p->chans);
+    free(p->items);
+    free(p->stages);
+    free(p);
+}
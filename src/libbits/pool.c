@@ -0,0 +1,559 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bits.h"
+#include "futex.h"
+
+#define CACHELINE 64
+
+/* slots in a worker's first deque ring and in the first injection queue */
+static ptrdiff_t const ringinit = 256;
+static size_t const injectinit = 64;
+
+/* rounds over the other workers before an idle worker parks */
+static int const idlespin = 64;
+
+/* feed messages taken per channelgetmany */
+enum
+{
+    feedbatch = 64
+};
+
+typedef struct Slot Slot;
+typedef struct Ring Ring;
+typedef struct Worker Worker;
+
+struct Slot
+{
+    void (*fn)(void *);
+    void *arg;
+};
+
+/* A deque's circular array.  Growing replaces it with one twice the size;
+ * thieves may still be reading the old one, so it stays on the older list
+ * until the pool is destroyed. */
+struct Ring
+{
+    ptrdiff_t size; /**< Power of two */
+    Slot *slots;
+    Ring *older;
+};
+
+/* Chase-Lev deque: the owner pushes and takes at bottom, thieves take from
+ * top with compare-and-swap, and the owner races them with compare-and-swap
+ * only for the last task (Le et al., "Correct and efficient work-stealing
+ * for weak memory models"). */
+struct Worker
+{
+    ptrdiff_t bottom; /**< Next slot to push, stored only by the owner */
+    Ring *ring;       /**< Current array, replaced only by the owner */
+    char pad0[CACHELINE - sizeof(ptrdiff_t) - sizeof(Ring *)];
+    ptrdiff_t top; /**< Oldest task, advanced by thieves and the owner */
+    char pad1[CACHELINE - sizeof(ptrdiff_t)];
+    Pool *pool;
+    unsigned seed; /**< Victim choice, private to the worker */
+    pthread_t tid;
+};
+
+struct Pool
+{
+    Worker *workers;
+    int nworkers;
+    int started;        /**< Worker threads running */
+    pthread_key_t self; /**< The calling thread's Worker, NULL elsewhere */
+
+    pthread_mutex_t lock; /**< Protects the injection queue */
+    Slot *inject;         /**< FIFO of tasks submitted from outside */
+    size_t front;         /**< Index of the oldest injected task */
+    size_t injected;      /**< Tasks in inject, also read without the lock */
+    size_t injectcap;
+
+    size_t pending; /**< Submitted tasks that have not finished */
+    int stop;       /**< Set by pooldestroy once pending is zero */
+    Event work;     /**< Idle workers park here, every submit notifies */
+    Event done;     /**< poolwait parks here until pending reaches zero */
+
+    Channel *feed;
+    void (*feedfn)(void *);
+    pthread_t feeder;
+};
+
+static void slotstore(Slot *s, void fn(void *), void *arg)
+{
+    __atomic_store_n(&s->fn, fn, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->arg, arg, __ATOMIC_RELAXED);
+}
+
+static void slotload(Slot *s, Slot *out)
+{
+    out->fn = __atomic_load_n(&s->fn, __ATOMIC_RELAXED);
+    out->arg = __atomic_load_n(&s->arg, __ATOMIC_RELAXED);
+}
+
+static Ring *ringcreate(ptrdiff_t size)
+{
+    Ring *r;
+
+    r = malloc(sizeof(*r));
+    if (r == NULL)
+        return NULL;
+
+    r->slots = malloc((size_t)size * sizeof(*r->slots));
+    if (r->slots == NULL)
+    {
+        free(r);
+        return NULL;
+    }
+
+    r->size = size;
+    r->older = NULL;
+    return r;
+}
+
+static void ringdestroy(Ring *r)
+{
+    Ring *older;
+
+    for (; r != NULL; r = older)
+    {
+        older = r->older;
+        free(r->slots);
+        free(r);
+    }
+}
+
+/* Copy tasks top..bottom into a ring twice the size and publish it. */
+static Ring *ringgrow(Worker *w, Ring *r, ptrdiff_t top, ptrdiff_t bottom)
+{
+    ptrdiff_t i;
+    Ring *g;
+    Slot s;
+
+    g = ringcreate(2 * r->size);
+    if (g == NULL)
+        return NULL;
+
+    for (i = top; i < bottom; ++i)
+    {
+        slotload(&r->slots[i & (r->size - 1)], &s);
+        g->slots[i & (g->size - 1)] = s;
+    }
+
+    g->older = r;
+    __atomic_store_n(&w->ring, g, __ATOMIC_RELEASE);
+    return g;
+}
+
+static int push(Worker *w, void fn(void *), void *arg)
+{
+    ptrdiff_t b, t;
+    Ring *r;
+
+    b = w->bottom;
+    t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    r = w->ring;
+
+    if (b - t > r->size - 1)
+    {
+        r = ringgrow(w, r, t, b);
+        if (r == NULL)
+            return -1;
+    }
+
+    slotstore(&r->slots[b & (r->size - 1)], fn, arg);
+    __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Owner: the newest task, or 0 when the deque is empty. */
+static int take(Worker *w, Slot *out)
+{
+    ptrdiff_t b, t;
+    Ring *r;
+    int ok = 1;
+
+    b = w->bottom - 1;
+    r = w->ring;
+    __atomic_store_n(&w->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&w->top, __ATOMIC_RELAXED);
+
+    if (t > b)
+    {
+        __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    slotload(&r->slots[b & (r->size - 1)], out);
+    if (t == b)
+    {
+        /* the last task: a thief may be after it too */
+        ok = __atomic_compare_exchange_n(&w->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+        __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+
+    return ok;
+}
+
+/* Thief: the oldest task of w; 0 when empty, -1 when another thread won it. */
+static int steal(Worker *w, Slot *out)
+{
+    ptrdiff_t b, t;
+    Ring *r;
+
+    t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b = __atomic_load_n(&w->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b)
+        return 0;
+
+    r = __atomic_load_n(&w->ring, __ATOMIC_ACQUIRE);
+    slotload(&r->slots[t & (r->size - 1)], out);
+    if (!__atomic_compare_exchange_n(&w->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return -1;
+
+    return 1;
+}
+
+/* Queue n tasks from outside the pool; the caller has counted them in pending. */
+static int inject(Pool *p, int n, Slot const *in)
+{
+    int i;
+    size_t k, cap;
+    Slot *grown;
+
+    if (pthread_mutex_lock(&p->lock) != 0)
+        return -1;
+
+    if (p->injected + (size_t)n > p->injectcap)
+    {
+        for (cap = p->injectcap * 2; cap < p->injected + (size_t)n; cap *= 2)
+            ;
+
+        grown = malloc(cap * sizeof(*grown));
+        if (grown == NULL)
+        {
+            (void)pthread_mutex_unlock(&p->lock);
+            return -1;
+        }
+
+        for (k = 0; k < p->injected; ++k)
+            grown[k] = p->inject[(p->front + k) % p->injectcap];
+
+        free(p->inject);
+        p->inject = grown;
+        p->injectcap = cap;
+        p->front = 0;
+    }
+
+    for (i = 0; i < n; ++i)
+        p->inject[(p->front + p->injected + (size_t)i) % p->injectcap] = in[i];
+
+    __atomic_store_n(&p->injected, p->injected + (size_t)n, __ATOMIC_RELAXED);
+    (void)pthread_mutex_unlock(&p->lock);
+
+    eventnotify(&p->work);
+    return 0;
+}
+
+/* The oldest injected task, or 0 when there is none. */
+static int dequeue(Pool *p, Slot *out)
+{
+    int ok = 0;
+
+    if (__atomic_load_n(&p->injected, __ATOMIC_RELAXED) == 0)
+        return 0;
+
+    if (pthread_mutex_lock(&p->lock) != 0)
+        return 0;
+
+    if (p->injected > 0)
+    {
+        *out = p->inject[p->front];
+        p->front = (p->front + 1) % p->injectcap;
+        __atomic_store_n(&p->injected, p->injected - 1, __ATOMIC_RELAXED);
+        ok = 1;
+    }
+
+    (void)pthread_mutex_unlock(&p->lock);
+    return ok;
+}
+
+/* xorshift: cheap, and good enough to spread thieves over victims */
+static unsigned nextrand(unsigned *seed)
+{
+    unsigned x = *seed;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *seed = x;
+}
+
+/* Own deque first, then the injection queue, then one pass over the other
+ * workers from a random start, repeated while steals lose races. */
+static int find(Worker *w, Slot *out)
+{
+    Pool *p = w->pool;
+    int i, n, rc, lost;
+
+    if (take(w, out) || dequeue(p, out))
+        return 1;
+
+    n = p->nworkers;
+    do
+    {
+        lost = 0;
+        for (i = 0; i < n; ++i)
+        {
+            Worker *v = &p->workers[(nextrand(&w->seed) + (unsigned)i) % (unsigned)n];
+
+            if (v == w)
+                continue;
+
+            rc = steal(v, out);
+            if (rc > 0)
+                return 1;
+            lost |= (rc < 0);
+        }
+    } while (lost);
+
+    return 0;
+}
+
+static void run(Pool *p, Slot *s)
+{
+    s->fn(s->arg);
+    if (__atomic_sub_fetch(&p->pending, 1, __ATOMIC_ACQ_REL) == 0)
+        eventnotify(&p->done);
+}
+
+static void *work(void *data)
+{
+    Worker *w = data;
+    Pool *p = w->pool;
+    Slot s;
+    uint32_t key;
+    int i;
+
+    (void)pthread_setspecific(p->self, w);
+
+    for (;;)
+    {
+        for (i = 0; i < idlespin; ++i)
+        {
+            if (find(w, &s))
+                goto runs;
+            cpurelax();
+        }
+
+        key = eventprepare(&p->work);
+        if (find(w, &s))
+            goto runs;
+        if (__atomic_load_n(&p->stop, __ATOMIC_ACQUIRE))
+            break;
+
+        (void)eventwait(&p->work, key, NULL);
+        continue;
+
+    runs:
+        run(p, &s);
+    }
+
+    return NULL;
+}
+
+/* Move feed messages into the injection queue a batch at a time. */
+static void *feed(void *data)
+{
+    Pool *p = data;
+    Message m[feedbatch];
+    Slot s[feedbatch];
+    int i, k, n;
+
+    for (;;)
+    {
+        n = channelgetmany(p->feed, feedbatch, m);
+        if (n <= 0)
+            break;
+
+        for (i = 0, k = 0; i < n && m[i].tag != Tclose; ++i, ++k)
+        {
+            s[k].fn = p->feedfn;
+            s[k].arg = (void *)m[i].value;
+        }
+
+        __atomic_fetch_add(&p->pending, (size_t)k, __ATOMIC_RELAXED);
+        if (k > 0 && inject(p, k, s) != 0)
+        {
+            /* nothing queued: give the count back */
+            if (__atomic_sub_fetch(&p->pending, (size_t)k, __ATOMIC_ACQ_REL) == 0)
+                eventnotify(&p->done);
+        }
+
+        if (i < n)
+            break;
+    }
+
+    return NULL;
+}
+
+Pool *poolcreate(int nworkers)
+{
+    int i;
+    Pool *p;
+
+    if (nworkers == 0)
+        nworkers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers < 1)
+        return NULL;
+
+    p = calloc(1, sizeof(*p));
+    if (p == NULL)
+        return NULL;
+
+    p->workers = calloc((size_t)nworkers, sizeof(*p->workers));
+    p->inject = malloc(injectinit * sizeof(*p->inject));
+    if (p->workers == NULL || p->inject == NULL)
+        goto freep;
+
+    p->nworkers = nworkers;
+    p->injectcap = injectinit;
+    eventinit(&p->work, 0, 0);
+    eventinit(&p->done, 0, 0);
+
+    for (i = 0; i < nworkers; ++i)
+    {
+        p->workers[i].ring = ringcreate(ringinit);
+        if (p->workers[i].ring == NULL)
+            goto freerings;
+
+        p->workers[i].pool = p;
+        p->workers[i].seed = 2654435761U * (unsigned)(i + 1);
+    }
+
+    if (pthread_key_create(&p->self, NULL) != 0)
+        goto freerings;
+
+    if (pthread_mutex_init(&p->lock, NULL) != 0)
+        goto deletekey;
+
+    for (; p->started < nworkers; ++p->started)
+    {
+        if (pthread_create(&p->workers[p->started].tid, NULL, work, &p->workers[p->started]) != 0)
+        {
+            pooldestroy(p);
+            return NULL;
+        }
+    }
+
+    return p;
+
+deletekey:
+    (void)pthread_key_delete(p->self);
+freerings:
+    for (i = 0; i < nworkers; ++i)
+        ringdestroy(p->workers[i].ring);
+freep:
+    free(p->inject);
+    free(p->workers);
+    free(p);
+    return NULL;
+}
+
+int poolsubmit(Pool *p, void fn(void *), void *arg)
+{
+    int rc;
+    Worker *w;
+    Slot s;
+
+    if (p == NULL || fn == NULL)
+        return -1;
+
+    __atomic_fetch_add(&p->pending, 1, __ATOMIC_RELAXED);
+
+    w = pthread_getspecific(p->self);
+    if (w != NULL)
+    {
+        rc = push(w, fn, arg);
+        if (rc == 0)
+            eventnotify(&p->work);
+    }
+    else
+    {
+        s.fn = fn;
+        s.arg = arg;
+        rc = inject(p, 1, &s);
+    }
+
+    if (rc != 0 && __atomic_sub_fetch(&p->pending, 1, __ATOMIC_ACQ_REL) == 0)
+        eventnotify(&p->done);
+
+    return rc;
+}
+
+int poolfeed(Pool *p, Channel *c, void fn(void *))
+{
+    if (p == NULL || c == NULL || fn == NULL || p->feed != NULL)
+        return -1;
+
+    p->feed = c;
+    p->feedfn = fn;
+    if (pthread_create(&p->feeder, NULL, feed, p) != 0)
+    {
+        p->feed = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+int poolwait(Pool *p)
+{
+    uint32_t key;
+
+    if (p == NULL || pthread_getspecific(p->self) != NULL)
+        return -1;
+
+    for (;;)
+    {
+        key = eventprepare(&p->done);
+        if (__atomic_load_n(&p->pending, __ATOMIC_ACQUIRE) == 0)
+            return 0;
+
+        if (eventwait(&p->done, key, NULL) != 0)
+            return -1;
+    }
+}
+
+void pooldestroy(Pool *p)
+{
+    int i;
+
+    if (p == NULL)
+        return;
+
+    if (p->feed != NULL)
+    {
+        channelclose(p->feed);
+        (void)pthread_join(p->feeder, NULL);
+    }
+
+    (void)poolwait(p);
+
+    __atomic_store_n(&p->stop, 1, __ATOMIC_SEQ_CST);
+    eventnotify(&p->work);
+
+    for (i = 0; i < p->started; ++i)
+        (void)pthread_join(p->workers[i].tid, NULL);
+
+    for (i = 0; i < p->nworkers; ++i)
+        ringdestroy(p->workers[i].ring);
+
+    (void)pthread_mutex_destroy(&p->lock);
+    (void)pthread_key_delete(p->self);
+    free(p->inject);
+    free(p->workers);
+    free(p);
+}